@@ -1,60 +1,823 @@
 /*
 * Created by Harsal Patel
 * 
-* Console text color changes and the ClearScreen() function work on Windows OS only. Please replace the ClearScreen() calls in main
-* with system("cls") and comment out or delete the lines that change text color if you are running this on another OS.
+* The console calls (text color, cursor position, getch) are Windows API calls. On other OSes they are replaced by small
+* stand-ins below that write ANSI escape sequences and read keys through termios, so the game runs in a Linux terminal as well.
 */
 
 #include <iostream>
 #include <stdlib.h>
 #include <time.h>
-#include <conio.h> // for getch
 #include <fstream>
 #include <math.h>
 #include <limits.h>
 #include <ctype.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono> // timing for the headless simulation and benchmarks
+#include <algorithm> // sort for latency percentiles
+#include <string.h> // strcmp for command line options
+#include <sys/types.h>
+#include <sys/stat.h> // modification times of compiled maps
+#include <string> // frame buffer for the renderer
+#include <sstream> // parses the session host's commands
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1 // SSE2 and AVX2 kernels for the dense Dijkstra, other CPUs only get the scalar one
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h> // __cpuidex
+#define TARGET_AVX2 // MSVC compiles AVX2 intrinsics without a flag
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#ifdef _WIN32
+#include <conio.h> // for getch
 #include <Windows.h> // used to change console text color
+#include <psapi.h> // peak working set for --world
+#else
+#include <sys/mman.h> // memory mapped map files
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h> // unbuffered key input
+#include <sys/ioctl.h> // terminal size
+#include <sys/socket.h> // local socket the session host can listen on
+#include <sys/un.h>
+#include <signal.h>
+#include <sys/resource.h> // peak resident set for --world
+#endif
 
 using namespace std;
 
-class Tile { // term used for each vertex in the map
-public:
+int AnsiColor(int attribute) { // maps a Windows console color (bit 0 blue, 1 green, 2 red, 3 bright) to an ANSI foreground code
+	int color = ((attribute & 4) ? 1 : 0) | ((attribute & 2) ? 2 : 0) | ((attribute & 1) ? 4 : 0);
+	return ((attribute & 8) ? 90 : 30) + color;
+}
+
+#ifndef _WIN32 // terminal stand-ins for the Windows console calls used by the game
+const int STD_OUTPUT_HANDLE = -11;
+struct COORD {
+	short X;
+	short Y;
+};
+
+int GetStdHandle(int handle) { return handle; }
+void SetConsoleTextAttribute(int, int attribute) { cout << "\x1b[" << AnsiColor(attribute) << "m"; }
+void SetConsoleCursorPosition(int, COORD position) { cout << "\x1b[" << position.Y + 1 << ";" << position.X + 1 << "H"; }
+
+int _getch() { // reads one key without waiting for enter or echoing it
+	cout.flush();
+	termios original, raw;
+	if (tcgetattr(STDIN_FILENO, &original) != 0) { return getchar(); } // not a terminal
+	raw = original;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+	int key = getchar();
+	tcsetattr(STDIN_FILENO, TCSANOW, &original);
+	return key;
+}
+#endif
+
+unsigned int& ScreenClears() { // counts full console clears, so FrameRenderer knows when its previous frame is gone
+	static unsigned int clears = 0;
+	return clears;
+}
+
+void ClearConsole() {
+	ScreenClears()++;
+#ifdef _WIN32
+	system("cls");
+#else
+	cout << "\x1b[2J\x1b[H" << flush;
+#endif
+}
+
+bool TerminalSize(int& columns, int& rows) {
+#ifdef _WIN32
+	CONSOLE_SCREEN_BUFFER_INFO info;
+	if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) { return false; }
+	columns = info.srWindow.Right - info.srWindow.Left + 1;
+	rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+#else
+	winsize size;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_col == 0) { return false; }
+	columns = size.ws_col;
+	rows = size.ws_row;
+#endif
+	return true;
+}
+
+enum TerrainCode { TERRAIN_WALL, TERRAIN_PLAIN, TERRAIN_GRASS, TERRAIN_HIDDEN, NUM_TERRAIN }; // packed 2 bits per tile, 4 tiles to a byte
+
+struct TerrainRule { // what a TerrainCode means to the characters, the movement and search code only ever reads it through the masks below
 	char symbol; // used to display in map
-	int vertex;
-	double weight;
-	Tile* next; // used for adjacency list
-	int pi; // predecessor used for Dijkstra's
-	Tile() {
-		vertex = 0;
-		weight = 0;
-		next = nullptr;
-		symbol = '!';
-		pi = -1;
-	}
-	Tile(int vertex, double weight, char symbol) {
-		this->vertex = vertex;
-		this->weight = weight;
-		next = nullptr;
-		this->symbol = symbol;
-		pi = -1;
-	}
-	~Tile() {}
+	char fileSymbol; // used in map files, which cannot rely on trailing spaces
+	int color; // console color the symbol is drawn in
+	int weight; // cost of moving onto the tile, 0 if nothing can be entered from it or onto it
+	bool enemyEnters; // enemies walk onto it, their searches only reach it when it is the target otherwise
+	bool playerEnters;
+	bool slow; // takes an additional step to move off
+	bool hides; // enemies cannot see the user standing on it
+	bool hasEdges; // linked to the tiles around it in the graph, the searches never expand it otherwise
+	bool blocksSight; // ends a line of sight
+};
+
+constexpr TerrainRule TERRAIN_RULES[NUM_TERRAIN] = {
+	{ 'X', 'X', 8, 0, false, false, false, false, false, true }, // TERRAIN_WALL, gray
+	{ ' ', '_', 15, 1, true, true, false, false, true, false }, // TERRAIN_PLAIN, white
+	{ '-', '-', 2, 2, true, true, true, false, true, false }, // TERRAIN_GRASS, green
+	{ 'H', 'H', 11, 1, false, true, false, true, true, false }, // TERRAIN_HIDDEN, cyan
+};
+static_assert(NUM_TERRAIN <= 4, "terrain is packed 2 bits per tile, more kinds of tile need a wider packing");
+struct TerrainColumns { // the symbol and weight columns of TERRAIN_RULES as arrays of their own, for the hot loops
+	char symbols[NUM_TERRAIN];
+	int weights[NUM_TERRAIN];
+	constexpr TerrainColumns() : symbols(), weights() {
+		for (int code = 0; code < NUM_TERRAIN; code++) {
+			symbols[code] = TERRAIN_RULES[code].symbol;
+			weights[code] = TERRAIN_RULES[code].weight;
+		}
+	}
+};
+constexpr TerrainColumns TERRAIN_COLUMNS;
+constexpr const char* TERRAIN_SYMBOLS = TERRAIN_COLUMNS.symbols;
+constexpr const int* TERRAIN_WEIGHTS = TERRAIN_COLUMNS.weights;
+// bit c is set when TERRAIN_RULES[c] has the property, so testing a tile is one shift
+constexpr int TerrainMask(bool TerrainRule::*property, int code = 0) {
+	return (code == NUM_TERRAIN) ? 0 : ((TERRAIN_RULES[code].*property) ? 1 << code : 0) | TerrainMask(property, code + 1);
+}
+constexpr int SLOW_TERRAIN = TerrainMask(&TerrainRule::slow);
+constexpr int HIDING_TERRAIN = TerrainMask(&TerrainRule::hides);
+constexpr int EDGE_TERRAIN = TerrainMask(&TerrainRule::hasEdges);
+constexpr int OPAQUE_TERRAIN = TerrainMask(&TerrainRule::blocksSight);
+bool HasRule(int mask, int code) { return (mask >> code) & 1; }
+
+struct EnemyRules { // rule set the movement and search kernels are specialised on
+	static constexpr int ENTERS = TerrainMask(&TerrainRule::enemyEnters);
+};
+
+struct PlayerRules {
+	static constexpr int ENTERS = TerrainMask(&TerrainRule::playerEnters);
 };
 
+template <class Rules> bool Enters(int code) { return (Rules::ENTERS >> code) & 1; }
+
+int TerrainFromSymbol(char symbol) { // takes either symbol of a tile, anything that is not one is plain
+	for (int code = 0; code < NUM_TERRAIN; code++) {
+		if (TERRAIN_RULES[code].symbol == symbol || TERRAIN_RULES[code].fileSymbol == symbol) { return code; }
+	}
+	return TERRAIN_PLAIN;
+}
+
+int SymbolColor(char symbol) { // console color a map symbol is drawn in
+	if (symbol == '#') { return 4; } // red
+	if (symbol == 'O') { return 14; } // tan
+	for (int code = 0; code < NUM_TERRAIN; code++) {
+		if (TERRAIN_RULES[code].symbol == symbol) { return TERRAIN_RULES[code].color; }
+	}
+	return 15; // white
+}
+
+int TerrainAt(const unsigned char* terrain, int vertex) { return (terrain[vertex >> 2] >> ((vertex & 3) * 2)) & 3; }
+
+enum Occupant { OCCUPANT_NONE, OCCUPANT_USER, OCCUPANT_ENEMY }; // characters drawn over the terrain
+
 struct Characters {
 	int vertex;
-	char tile;
 	bool seesUser;
 	int counter;
 };
 
+// kernels for the dense Dijkstra, which keeps its frontier as a flat array of keys instead of a queue, INT_MAX for vertices
+// not in it. The smallest key of every 8 is kept in a block array and the smallest of every 8 blocks in a group array, so
+// DensePop finds the next vertex by scanning groups [begin, end) (multiples of 8), then one group and one block, takes
+// it out of the frontier and brings both minimums up to date. RelaxMask sets bit i where alt[i] < key[i] for 4 lanes.
+// Each exists as scalar, SSE2 and AVX2 code and SelectSimd points them at the best one the CPU runs.
+enum SimdLevel { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 };
+const char* SIMD_NAMES[3] = { "scalar", "sse2", "avx2" };
+
+int FirstBit(int mask) { // index of the lowest set bit, mask is not 0
+	int i = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		i++;
+	}
+	return i;
+}
+
+int ArgMinScalar(const int* values, int count) {
+	int best = 0;
+	for (int i = 1; i < count; i++) {
+		if (values[i] < values[best]) { best = i; }
+	}
+	return best;
+}
+
+int Min8Scalar(const int* values) { return values[ArgMinScalar(values, 8)]; }
+
+int DensePopScalar(int* key, int* blockMin, int* groupMin, int begin, int end) {
+	int group = begin + ArgMinScalar(groupMin + begin, end - begin);
+	if (groupMin[group] == INT_MAX) { return -1; } // frontier is empty
+	int block = group * 8 + ArgMinScalar(blockMin + group * 8, 8);
+	int u = block * 8 + ArgMinScalar(key + block * 8, 8);
+	key[u] = INT_MAX;
+	blockMin[block] = Min8Scalar(key + block * 8);
+	groupMin[group] = Min8Scalar(blockMin + group * 8);
+	return u;
+}
+
+int RelaxMaskScalar(const int* alt, const int* key) {
+	int mask = 0;
+	for (int i = 0; i < 4; i++) {
+		if (alt[i] < key[i]) { mask |= 1 << i; }
+	}
+	return mask;
+}
+
+#ifdef SIMD_X86
+__m128i Min4Sse2(__m128i a, __m128i b) { // SSE2 has no 32 bit min, so it is a compare and select
+	__m128i greater = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(greater, b), _mm_andnot_si128(greater, a));
+}
+
+int Min8Sse2(const int* values) {
+	__m128i m = Min4Sse2(_mm_loadu_si128((const __m128i*)values), _mm_loadu_si128((const __m128i*)(values + 4)));
+	m = Min4Sse2(m, _mm_shuffle_epi32(m, 0x4E));
+	m = Min4Sse2(m, _mm_shuffle_epi32(m, 0xB1));
+	return _mm_cvtsi128_si32(m);
+}
+
+int ArgMinSse2(const int* values, int count) { // count is a multiple of 8
+	__m128i best = _mm_set1_epi32(INT_MAX);
+	for (int i = 0; i < count; i += 4) { best = Min4Sse2(best, _mm_loadu_si128((const __m128i*)(values + i))); }
+	best = Min4Sse2(best, _mm_shuffle_epi32(best, 0x4E));
+	best = Min4Sse2(best, _mm_shuffle_epi32(best, 0xB1));
+	__m128i smallest = _mm_shuffle_epi32(best, 0);
+	for (int i = 0; i < count; i += 4) {
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(values + i)), smallest)));
+		if (mask) { return i + FirstBit(mask); }
+	}
+	return 0;
+}
+
+int DensePopSse2(int* key, int* blockMin, int* groupMin, int begin, int end) {
+	int group = begin + ArgMinSse2(groupMin + begin, end - begin);
+	if (groupMin[group] == INT_MAX) { return -1; }
+	int block = group * 8 + ArgMinSse2(blockMin + group * 8, 8);
+	int u = block * 8 + ArgMinSse2(key + block * 8, 8);
+	key[u] = INT_MAX;
+	blockMin[block] = Min8Sse2(key + block * 8);
+	groupMin[group] = Min8Sse2(blockMin + group * 8);
+	return u;
+}
+
+int RelaxMaskSse2(const int* alt, const int* key) {
+	__m128i better = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)alt), _mm_loadu_si128((const __m128i*)key));
+	return _mm_movemask_ps(_mm_castsi128_ps(better));
+}
+
+TARGET_AVX2 __m256i Broadcast8MinAvx2(__m256i v) { // every lane set to the smallest of the 8
+	v = _mm256_min_epi32(v, _mm256_permute2x128_si256(v, v, 1));
+	v = _mm256_min_epi32(v, _mm256_shuffle_epi32(v, 0x4E));
+	return _mm256_min_epi32(v, _mm256_shuffle_epi32(v, 0xB1));
+}
+
+TARGET_AVX2 int ArgMinAvx2(const int* values, int count) { // count is a multiple of 8
+	__m256i best = _mm256_set1_epi32(INT_MAX);
+	for (int i = 0; i < count; i += 8) { best = _mm256_min_epi32(best, _mm256_loadu_si256((const __m256i*)(values + i))); }
+	__m256i smallest = Broadcast8MinAvx2(best);
+	for (int i = 0; i < count; i += 8) {
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(values + i)), smallest)));
+		if (mask) { return i + FirstBit(mask); }
+	}
+	return 0;
+}
+
+TARGET_AVX2 int Min8Avx2(const int* values) {
+	return _mm_cvtsi128_si32(_mm256_castsi256_si128(Broadcast8MinAvx2(_mm256_loadu_si256((const __m256i*)values))));
+}
+
+TARGET_AVX2 int DensePopAvx2(int* key, int* blockMin, int* groupMin, int begin, int end) {
+	int group = begin + ArgMinAvx2(groupMin + begin, end - begin);
+	if (groupMin[group] == INT_MAX) { return -1; }
+	int block = group * 8 + ArgMinAvx2(blockMin + group * 8, 8);
+	int u = block * 8 + ArgMinAvx2(key + block * 8, 8);
+	key[u] = INT_MAX;
+	blockMin[block] = Min8Avx2(key + block * 8);
+	groupMin[group] = Min8Avx2(blockMin + group * 8);
+	return u;
+}
+
+bool CpuHasAvx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) { return false; }
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28))) { return false; } // OSXSAVE and AVX
+	if ((_xgetbv(0) & 6) != 6) { return false; } // the OS saves the YMM registers
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+int (*DensePop)(int* key, int* blockMin, int* groupMin, int begin, int end) = DensePopScalar;
+int (*RelaxMask)(const int* alt, const int* key) = RelaxMaskScalar;
+// uses the given level, or the best one below it the CPU supports, and returns the level it ended up with
+SimdLevel SelectSimd(SimdLevel level) {
+#ifdef SIMD_X86
+	if (level >= SIMD_AVX2 && CpuHasAvx2()) {
+		DensePop = DensePopAvx2;
+		RelaxMask = RelaxMaskSse2; // 4 neighbours fill an SSE register, AVX2 has nothing to add
+		return SIMD_AVX2;
+	}
+	if (level >= SIMD_SSE2) { // part of every x86-64 CPU
+		DensePop = DensePopSse2;
+		RelaxMask = RelaxMaskSse2;
+		return SIMD_SSE2;
+	}
+#endif
+	DensePop = DensePopScalar;
+	RelaxMask = RelaxMaskScalar;
+	return SIMD_SCALAR;
+}
+
+SimdLevel simdLevel = SelectSimd(SIMD_AVX2);
+
+class BinaryHeap { // min-heap of (distance, vertex) pairs used as the frontier in Dijkstra's
+private:
+	int* keys;
+	int* vertices;
+	int size;
+	int capacity;
+	void expand();
+	void swap(int a, int b);
+public:
+	BinaryHeap() {
+		size = 0;
+		capacity = 64;
+		keys = new int[capacity];
+		vertices = new int[capacity];
+	}
+	~BinaryHeap() {
+		delete[] keys;
+		delete[] vertices;
+	}
+	void push(int vertex, int key);
+	int pop(); // removes and returns the vertex with the smallest key
+	bool empty() { return size == 0; }
+	void clear() { size = 0; }
+	int minKey() { return keys[0]; } // only valid if the heap is not empty
+};
+
+class BucketQueue { // Dial's bucket queue, only works because edge weights are small integers (1 for plain, 2 for grass)
+private:
+	int** buckets; // circular array of buckets, bucket i holds vertices whose key % numBuckets == i
+	int* bucketSizes;
+	int* bucketCapacities;
+	int numBuckets;
+	int cursor; // bucket holding the smallest key still in the queue
+	int count;
+	void expandBucket(int b);
+public:
+	BucketQueue(int maxWeight) { // keys in the queue never span more than maxWeight + 1 buckets
+		numBuckets = maxWeight + 1;
+		buckets = new int* [numBuckets];
+		bucketSizes = new int[numBuckets];
+		bucketCapacities = new int[numBuckets];
+		for (int i = 0; i < numBuckets; i++) {
+			bucketCapacities[i] = 16;
+			bucketSizes[i] = 0;
+			buckets[i] = new int[bucketCapacities[i]];
+		}
+		cursor = 0;
+		count = 0;
+	}
+	~BucketQueue() {
+		for (int i = 0; i < numBuckets; i++) { delete[] buckets[i]; }
+		delete[] buckets;
+		delete[] bucketSizes;
+		delete[] bucketCapacities;
+	}
+	void push(int vertex, int key);
+	int pop(); // removes and returns a vertex with the smallest key
+	bool empty() { return count == 0; }
+	void clear();
+	void widen(int maxWeight); // empties the queue and makes sure it has enough buckets, more than needed does no harm
+};
+
+class SearchContext { // scratch space owned by one thread and reused by each of its searches, so starting a search allocates
+public:               // nothing and costs O(1) instead of clearing arrays the size of the map
+	int* dist;
+	int* pi; // predecessor of each vertex on its shortest path
+	unsigned int* stamp; // dist and pi are only valid where stamp >= epoch, and the vertex is settled where stamp == epoch + 1
+	int capacity;
+	unsigned int epoch;
+	int* abstractDist; // the same for searches on the abstract graph, indexed by cluster * 4 * clusterSize + slot
+	int* abstractPrev;
+	unsigned int* abstractStamp;
+	int abstractCapacity;
+	unsigned int abstractEpoch;
+	int abstractPushes; // entries queued by the abstract search in progress, for Instrumentation
+	int* backwardDist; // the same for the backward half of a bidirectional search
+	int* backwardPi;
+	unsigned int* backwardStamp;
+	int backwardCapacity;
+	unsigned int backwardEpoch;
+	int* denseKey; // frontier of the dense Dijkstra, tentative distance of each vertex in it and INT_MAX for the rest
+	int* denseBlockMin; // smallest key of each block of 8 keys
+	int* denseGroupMin; // smallest of each group of 8 blocks
+	int denseCapacity; // multiple of 512 so every array is whole vectors, all of them are INT_MAX again between searches
+	int* path; // tiles of the path the last query searched for, source first, until it is stored in the path cache
+	int pathLength; // 0 when there is nothing to store
+	int pathSize;
+	int pathTarget;
+	BinaryHeap heap;
+	BucketQueue buckets;
+	SearchContext() : buckets(1) {
+		dist = nullptr;
+		pi = nullptr;
+		stamp = nullptr;
+		capacity = 0;
+		epoch = 0;
+		abstractDist = nullptr;
+		abstractPrev = nullptr;
+		abstractStamp = nullptr;
+		abstractCapacity = 0;
+		abstractEpoch = 0;
+		abstractPushes = 0;
+		backwardDist = nullptr;
+		backwardPi = nullptr;
+		backwardStamp = nullptr;
+		backwardCapacity = 0;
+		backwardEpoch = 0;
+		denseKey = nullptr;
+		denseBlockMin = nullptr;
+		denseGroupMin = nullptr;
+		denseCapacity = 0;
+		path = nullptr;
+		pathLength = 0;
+		pathSize = 0;
+		pathTarget = -1;
+	}
+	~SearchContext() {
+		delete[] dist;
+		delete[] pi;
+		delete[] stamp;
+		delete[] abstractDist;
+		delete[] abstractPrev;
+		delete[] abstractStamp;
+		delete[] backwardDist;
+		delete[] backwardPi;
+		delete[] backwardStamp;
+		delete[] denseKey;
+		delete[] denseBlockMin;
+		delete[] denseGroupMin;
+		delete[] path;
+	}
+	void begin(int vertices); // starts a search on a graph of this many vertices
+	void beginAbstract(int ids);
+	void beginBackward(int vertices);
+	void reserveDense(int vertices);
+	void tracePath(int source, int target); // copies the path found by the last search into path, just source if there was none
+	bool reached(int v) { return stamp[v] >= epoch; }
+	bool isSettled(int v) { return stamp[v] == epoch + 1; }
+	void settle(int v) { stamp[v] = epoch + 1; }
+	void reach(int v, int d, int p) { // only called on vertices that are not settled yet
+		dist[v] = d;
+		pi[v] = p;
+		stamp[v] = epoch;
+	}
+	bool abstractReached(int id) { return abstractStamp[id] >= abstractEpoch; }
+	bool abstractSettled(int id) { return abstractStamp[id] == abstractEpoch + 1; }
+	bool backwardReached(int v) { return backwardStamp[v] >= backwardEpoch; }
+	bool backwardSettled(int v) { return backwardStamp[v] == backwardEpoch + 1; }
+};
+
+const int PATH_CACHE_WAYS = 4; // entries a (source, target) pair can go in, the oldest of them is replaced when all are taken
+const int PATH_CACHE_STEPS = 32; // steps from the start of each path that are cached, enemies rarely follow one further
+const int DEFAULT_PATH_CACHE = 1024; // entries cached by the game
+
+struct PathEntry {
+	int source;
+	int target;
+	int next; // tile after source on a shortest path to target, source itself if target cannot be reached
+	int generation;
+};
+
+class PathCache { // bounded table of next steps keyed by (source, target), filled with every step along the paths searches
+private:          // find so an enemy that has moved along a path finds the rest of it, and emptied in O(1) by a new generation
+	PathEntry* entries; // PATH_CACHE_WAYS per set
+	unsigned char* victim; // way of each set replaced next
+	int numSets; // power of two
+	int* mark; // generation each tile was last on a stored path in, so setTile can tell whether a tile matters
+	int markSize;
+	int generation; // entries and marks from older generations are empty
+	int setOf(int source, int target) { return (int)(((unsigned int)source * 0x9E3779B1u ^ (unsigned int)target * 0x85EBCA77u) >> 7) & (numSets - 1); }
+public:
+	atomic<long long> hits;
+	atomic<long long> misses;
+	PathCache(int capacity);
+	~PathCache() {
+		delete[] entries;
+		delete[] victim;
+		delete[] mark;
+	}
+	void clear(int vertices); // drops every entry and makes room to mark this many tiles
+	int find(int source, int target); // -1 on a miss, only reads the table so planning threads can share it
+	void store(const int* path, int length, int target);
+	bool onPath(int vertex) { return vertex < markSize && mark[vertex] == generation; }
+};
+
+struct EdgeSpan { // contiguous run of a vertex's outgoing edges inside the CSR arrays
+	const int* targets;
+	const unsigned char* weights;
+	int count;
+};
+
+struct EdgeBuffer { // scratch space for graph views that compute a vertex's edges on the fly
+	int targets[4];
+	unsigned char weights[4];
+};
+
+class CsrGraph { // explicit adjacency built by Map::mapToGraph
+public:
+	const int* offsets;
+	const int* targets;
+	const unsigned char* weights;
+	EdgeSpan edges(int u, EdgeBuffer&) const { return { targets + offsets[u], weights + offsets[u], offsets[u + 1] - offsets[u] }; }
+};
+
+class GridGraph { // implicit 4-connected grid, neighbours come from the width stride and costs straight from the terrain
+public:
+	const unsigned char* terrain;
+	int width;
+	int height;
+	EdgeSpan edges(int u, EdgeBuffer& buffer) const;
+};
+
+enum QueueType { BINARY_HEAP, BUCKET_QUEUE, DENSE_ARRAY, AUTO_QUEUE }; // frontier used by Map::Dijkstra, AUTO_QUEUE picks DENSE_ARRAY
+                                                                       // up to DENSE_MAX_VERTICES tiles and BUCKET_QUEUE above
+// largest map the dense Dijkstra beats the bucket queue on, from --crossover. It lost at every size measured, 64 to 25600
+// tiles on open maps and mazes (784 tiles: 48 us dense AVX2 against 19 us bucket and 35 us heap), so AUTO_QUEUE always
+// picks the bucket queue for now. Raise this if --crossover shows dense winning on another CPU.
+const int DENSE_MAX_VERTICES = 0;
+enum GraphType { IMPLICIT_GRID, CSR_GRAPH }; // graph representation searched by Map::Dijkstra
+enum ChaseMode { CHASE_DIJKSTRA, CHASE_FLOW_FIELD, CHASE_ASTAR, CHASE_HIERARCHICAL, CHASE_INCREMENTAL, CHASE_LANDMARKS, CHASE_CONTRACTION }; // how enemies that see the user pick their next step
+
+const int MAX_CLUSTER_SIZE = 32; // clusters are at most this many tiles wide and high
+const int MAX_CLUSTER_TILES = MAX_CLUSTER_SIZE * MAX_CLUSTER_SIZE;
+const unsigned char NO_SLOT = 255; // marks a tile that is not an entrance of its cluster
+
+struct Cluster { // square block of tiles in the abstract graph used for hierarchical pathfinding
+	int* nodes; // entrance tiles on the border of the cluster
+	int numNodes;
+	int* dist; // dist[a * numNodes + b] is the shortest path from node a to node b that stays inside the cluster
+};
+
+struct ComponentBox { // columns and rows of the smallest rectangle holding a component's tiles
+	int left;
+	int top;
+	int right;
+	int bottom;
+};
+
+const int SIGHT_RADIUS = 8; // enemies see this many tiles up, down, left and right, fits in the 4 bits Map::sight stores per direction
+const int INDEX_ENEMIES = 64; // above this many enemies the map indexes them by tile instead of looking through every enemy
+
+const int DEFAULT_LANDMARKS = 8; // landmarks built for CHASE_LANDMARKS when no count was given
+const int MAX_LANDMARKS = 32;
+
+const int INCREMENTAL_INF = INT_MAX / 2; // leaves room to add an edge weight without overflowing
+
+const int WITNESS_SETTLE_LIMIT = 64; // a witness search gives up after this many tiles and the shortcut is added to be safe
+
+struct ContractionEdge { // edge of the graph while it is being contracted
+	int target;
+	int weight;
+	int middle; // tile the shortcut skips over, -1 for an edge between neighbouring tiles
+};
+
+struct ContractionList { // edges of one tile to the tiles not contracted yet
+	ContractionEdge* edges;
+	int count;
+	int capacity;
+};
+
+struct IncrementalSearch { // D* Lite state kept by one enemy between turns, searching backwards from the user
+	int* g; // distance from each tile to the goal as of the last expansion
+	int* rhs; // one step lookahead of g, a tile is consistent when g == rhs
+	int* heap; // inconsistent tiles ordered by key
+	int* key1; // keys of the heap entries, compared first by key1 then key2
+	int* key2;
+	int* position; // position of each tile in the heap, -1 if it is not queued
+	int heapSize;
+	int km; // accumulated heuristic change from the enemy moving, keeps old keys valid
+	int start; // enemy vertex the keys were computed for
+	int goal; // user vertex the search is rooted at
+	int version; // mapVersion the state is up to date with
+};
+
+class MappedFile { // read-only view of a whole file, memory mapped when the OS allows it and read into memory otherwise
+private:
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+	char* buffer; // only used when mapping failed
+public:
+	const char* data;
+	size_t size;
+	MappedFile() {
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#endif
+		buffer = nullptr;
+		data = nullptr;
+		size = 0;
+	}
+	~MappedFile() { close(); }
+	bool open(string filename, bool copyOnWrite = false); // copy on write views can be written to without changing the file
+	void close();
+};
+
+enum TileClass { TILE_NONE, TILE_TERRAIN, TILE_PLAYER = TILE_TERRAIN + NUM_TERRAIN, TILE_ENEMY, TILE_OTHER, NUM_TILE_CLASSES }; // terrain code c is TILE_TERRAIN + c
+
+const char MAP_FORMAT_MAGIC[4] = { 'D', 'S', 'P', 'M' };
+const int MAP_FORMAT_VERSION = 1; // bump whenever the layout of a compiled map changes, older files are then ignored
+
+struct MapFileHeader { // start of a compiled map, followed by the section table, every section starts on an 8 byte boundary
+	char magic[4];
+	int version;
+	int width;
+	int height;
+	int numVertices;
+	int player; // vertex of the user
+	int numEnemies;
+	int numHiddenTiles;
+	int numEdges; // 0 if the file holds no adjacency
+	int numSections;
+};
+
+enum MapSectionType { SECTION_TILES, SECTION_ENEMIES, SECTION_HIDDEN, SECTION_EDGE_OFFSETS, SECTION_EDGE_TARGETS, SECTION_EDGE_WEIGHTS,
+	SECTION_LANDMARKS, SECTION_LANDMARK_DIST, NUM_SECTION_TYPES };
+
+struct MapSection { // unknown section types are skipped, so optional data can be added without breaking older readers
+	int type;
+	int reserved;
+	long long offset; // from the start of the file
+	long long size; // in bytes
+};
+
+class ThreadPool { // fixed set of worker threads that split a range of tasks and steal from each other once they run out
+private:
+	struct Range { // tasks not yet started by a worker, the owner takes from the front and thieves from the back
+		mutex lock;
+		int begin;
+		int end;
+	};
+	thread* workers;
+	Range* ranges;
+	int numThreads; // the thread calling run counts as worker 0
+	mutex jobLock;
+	condition_variable jobReady;
+	condition_variable jobDone;
+	function<void(int, int)> job; // called with the task index and the worker running it
+	int generation;
+	int busy;
+	bool stopping;
+	bool take(int self, int& task);
+	bool steal(int self);
+	void work(int self);
+	void workerLoop(int self);
+public:
+	ThreadPool(int n) {
+		numThreads = (n < 1) ? 1 : n;
+		ranges = new Range[numThreads];
+		generation = 0;
+		busy = 0;
+		stopping = false;
+		workers = new thread[numThreads];
+		for (int i = 1; i < numThreads; i++) { workers[i] = thread(&ThreadPool::workerLoop, this, i); }
+	}
+	~ThreadPool() {
+		{
+			lock_guard<mutex> guard(jobLock);
+			stopping = true;
+		}
+		jobReady.notify_all();
+		for (int i = 1; i < numThreads; i++) { workers[i].join(); }
+		delete[] workers;
+		delete[] ranges;
+	}
+	void run(int count, function<void(int, int)> task); // runs task(0..count - 1) across all workers and waits for them
+	int size() { return numThreads; }
+};
+
+enum PlanAction { PLAN_STAY, PLAN_GRASS, PLAN_WANDER, PLAN_CHASE, PLAN_CATCH };
+enum PlanState { PLAN_PENDING, PLAN_WAITING, PLAN_APPLIED }; // PLAN_WAITING while the enemy in the way is applied first
+
+struct EnemyPlan { // decision made for one enemy in the planning phase of a parallel turn
+	PlanAction action;
+	int target;
+	int* path; // path the chase searched for, stored in the path cache when the plans are applied, see SearchContext::path
+	int pathLength;
+	int pathSize;
+	int pathTarget;
+	PlanState state;
+	bool claimed; // the enemy was the first to reserve target
+	EnemyPlan() {
+		path = nullptr;
+		pathLength = 0;
+		pathSize = 0;
+		pathTarget = -1;
+	}
+	~EnemyPlan() { delete[] path; }
+};
+
+#ifndef INSTRUMENTATION
+#define INSTRUMENTATION 1 // build with -DINSTRUMENTATION=0 to compile every probe out
+#endif
+#if INSTRUMENTATION
+#define PROBE(...) __VA_ARGS__
+#else
+#define PROBE(...)
+#endif
+
+long long NowNanos() { return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count(); }
+
+const int HISTOGRAM_BUCKETS = 40; // bucket 0 counts zeros, bucket b counts values from 2^(b-1) up to 2^b, the last one everything above
+
+class Histogram { // fixed power of two buckets, safe to add to from the planning threads
+private:
+	atomic<long long> buckets[HISTOGRAM_BUCKETS];
+	atomic<long long> count;
+	atomic<long long> total;
+	atomic<long long> largest;
+public:
+	Histogram() { clear(); }
+	void clear();
+	void add(long long value);
+	long long getCount() { return count; }
+	bool write(ostream& out, const char* name, bool csv);
+};
+// counters recorded by Map while Instrumentation is attached with setInstrumentation. Searches record what they settled,
+// relaxed and queued, path queries their time, and each turn the time spent in its phases, which the caller brackets
+// with beginTurn and endTurn so rendering or anything else it does can be added to the turn.
+class Instrumentation {
+private:
+	long long turnStart;
+public:
+	Histogram searchSettled;
+	Histogram searchRelaxed;
+	Histogram searchQueueOps;
+	Histogram queryNanos;
+	Histogram turnNanos;
+	Histogram movementNanos; // whatever the turn spent outside the other phases
+	Histogram visibilityNanos;
+	Histogram pathingNanos; // enemies deciding where to go, summed over the enemies in the one-by-one update and the wall time of planning in the threaded one
+	Histogram renderingNanos;
+	atomic<long long> edgeLookups; // hasEdge calls
+	long long turnVisibility; // phases of the turn in progress
+	long long turnPathing;
+	long long turnRendering;
+	Instrumentation() { clear(); }
+	void clear();
+	void recordSearch(int settled, int relaxed, int queueOps);
+	void beginTurn();
+	void endTurn();
+	bool dump(string filename); // CSV if the name ends in .csv, JSON otherwise
+};
+
 class Map {
 private:
 	int mapSize;
 	int numVertices;
-	Tile* map; // array of tiles representing a map
-	Tile** list; // adjacency list, array of arrays
-	Tile** current; // used in destructor
+	int width; // tiles per row, maps do not need to be square
+	int height;
+	unsigned char* terrain; // TerrainCode of every tile packed 2 bits each, read with TerrainAt
+	unsigned char* occupancy; // Occupant of every tile
+	bool terrainMapped; // terrain points into compiled or another map instead of being allocated
+	bool terrainShared; // terrain belongs to the map given to shareFrom, setTile copies it before writing
+	int* edgeOffsets; // compressed sparse row adjacency, edges of u are edgeOffsets[u] to edgeOffsets[u + 1] - 1
+	int* edgeTargets;
+	unsigned char* edgeWeights;
+	int numEdges;
+	int edgesVersion; // mapVersion the edge arrays were built or loaded for
+	bool edgesMapped; // edge arrays point into compiled or another map instead of being allocated
+	MappedFile compiled; // compiled map file, kept open while its adjacency is in use
+	void freeEdges();
+	void freeTerrain();
+	void closeCompiled();
+	void reserve(int tiles, int enemyCount, int hiddenCount);
+	bool loadCompiled(string filename);
 	Characters user; // info of player
 	Characters* enemies; // array of enemies
 	int numEnemies;
@@ -62,555 +825,4659 @@ private:
 	int* hiddenTiles;
 	int numHiddenTiles;
 	int hiddenSize;
-	bool canMove(int vertex, int direction);
-	bool adjacentHidden(int vertex, int direction);
+	int terrainCode(int vertex) { return TerrainAt(terrain, vertex); }
+	int weightAt(int vertex) { return TERRAIN_WEIGHTS[terrainCode(vertex)]; }
+	void setTerrain(int vertex, int code) { terrain[vertex >> 2] = (unsigned char)((terrain[vertex >> 2] & ~(3 << ((vertex & 3) * 2))) | (code << ((vertex & 3) * 2))); }
+	bool freeGround(int vertex) { return occupancy[vertex] == OCCUPANT_NONE && Enters<EnemyRules>(terrainCode(vertex)); }
+	int* enemyAt; // enemy standing on each tile or -1, only kept when there are more than INDEX_ENEMIES enemies
+	void indexEnemies();
+	void freeEnemyIndex();
+	void placeEnemy(int enemy, int vertex);
+	template <class Rules> bool canEnter(int vertex, int direction);
+	bool canMove(int vertex, int direction) { return canEnter<EnemyRules>(vertex, direction); }
+	bool slowedDown(Characters& c) { return HasRule(SLOW_TERRAIN, terrainCode(c.vertex)) && c.counter == 0; }
 	bool adjacentPlayer(int vertex);
 	void setVisibility();
-	int minDistance(int* dist, bool* visited);
-	int Dijkstra(int source, int target);
+	void spotUser();
+	unsigned char* sight; // per tile, how many open tiles can be seen in each direction, left and right in byte 2v, up and down in 2v + 1
+	int sightVersion; // mapVersion sight is up to date with
+	bool sightShared; // sight belongs to another map
+	int sightReach(int vertex, int direction) { unsigned char b = sight[2 * vertex + (direction < 2)]; return (direction & 1) ? b >> 4 : b & 15; }
+	void setSightReach(int vertex, int direction, int reach);
+	bool inSight(int from, int to);
+	void buildSight();
+	void updateSight(int vertex);
+	void freeSight();
+	int maxWeight; // largest edge weight in the graph, sizes the bucket queue
+	int minWeight; // smallest edge weight in the graph, scales the A* heuristic so it never overestimates
+	atomic<int> settled; // vertices settled by the last search, used to compare search modes
+	QueueType queueType;
+	GraphType graphType;
+	int neighbour(int vertex, int direction);
+	CsrGraph csrView() { return { edgeOffsets, edgeTargets, edgeWeights }; }
+	GridGraph gridView() { return { terrain, width, height }; }
+	EdgeSpan edges(int u, EdgeBuffer& buffer);
+	int Dijkstra(SearchContext& context, int source, int target);
+	template <class Graph> int Dijkstra(SearchContext& context, const Graph& graph, int source, int target);
+	template <class Rules, class Queue, class Graph> int search(SearchContext& context, Queue& frontier, const Graph& graph, int source, int target);
+	template <class Rules> int denseSearch(SearchContext& context, int source, int target);
+	int firstStep(int* pi, int source, int target);
+	int heuristic(int u, int target);
+	int lowerBound(int u, int target);
+	int AStar(SearchContext& context, int source, int target);
+	template <class Graph> int AStar(SearchContext& context, const Graph& graph, int source, int target);
+	template <class Rules, class Queue, class Graph> int aStarSearch(SearchContext& context, Queue& frontier, const Graph& graph, int source, int target);
+	ChaseMode chaseMode;
+	int mapVersion; // bumped whenever the tiles are reloaded so cached search results can be thrown away
+	int* flowDist; // distance from every tile to the user, shared by all chasing enemies
+	int* flowNext; // next step from every tile towards the user, -1 if the user cannot be reached
+	int flowTarget; // user vertex the flow field was built for, -1 if there is no field
+	int flowVersion; // mapVersion the flow field was built for
+	void updateFlowField(int target);
+	template <class Rules, class Queue, class Graph> void buildFlowField(SearchContext& context, Queue& frontier, const Graph& graph, int target);
+	int nextStep(int enemy, SearchContext& context);
+	int pathStep(int source, int target, SearchContext& context);
+	int findStep(int source, int target, SearchContext& context);
+	PathCache* pathCache; // nullptr when paths are not cached
+	int pathCacheVersion; // mapVersion the cached paths are shortest paths for
+	bool cachesPaths() { return pathCache && (chaseMode == CHASE_DIJKSTRA || chaseMode == CHASE_ASTAR || chaseMode == CHASE_LANDMARKS); }
+	void refreshPathCache();
+	void storePath(SearchContext& context);
+	int clusterSize; // width and height of a cluster in tiles, 0 if no hierarchy has been built
+	int clustersWide;
+	int clustersHigh;
+	Cluster* clusters;
+	unsigned char* nodeSlot; // index of each tile in its cluster's node list, NO_SLOT if it is not an entrance
+	int hierarchyVersion; // mapVersion the hierarchy is up to date with
+	bool hierarchyShared; // clusters and nodeSlot belong to another map
+	bool enemyPassable(int v) { return Enters<EnemyRules>(terrainCode(v)); }
+	int* component; // piece of the enemy passable tiles each tile belongs to, -1 for tiles enemies cannot stand on
+	int* componentTiles; // tiles in each component, 0 once it has been merged into another or split up
+	ComponentBox* componentBoxes; // may be larger than the component after some of its tiles closed
+	int* componentQueue; // breadth first search scratch, one slot per tile
+	int numComponents; // labels handed out, including the dead ones
+	int componentsSize;
+	int liveComponents;
+	int componentVersion; // mapVersion the components are up to date with
+	bool componentsShared; // component arrays belong to another map
+	void buildComponents();
+	void freeComponents();
+	int newComponent();
+	void growComponentBox(int c, int vertex);
+	void labelComponent(int start, int from, int label);
+	void openComponentTile(int vertex);
+	void closeComponentTile(int vertex);
+	bool ringConnected(int vertex);
+	int clusterOf(int v) { return (v / width / clusterSize) * clustersWide + (v % width) / clusterSize; }
+	int localIndex(int c, int v) { return (v / width - (c / clustersWide) * clusterSize) * clusterSize + (v % width - (c % clustersWide) * clusterSize); }
+	void freeHierarchy();
+	void buildCluster(int c);
+	void addEntrances(int c, int side, int* nodes, int& numNodes);
+	void clusterSearch(int c, int from, bool reverse, int* dist, int* pi, BinaryHeap& frontier);
+	void relaxAbstract(SearchContext& context, int id, int dist, int prev, int key, BinaryHeap& frontier);
+	void updateHierarchy(int vertex);
+	int hierarchicalStep(int source, int target, SearchContext& context);
+	int* landmarks; // tiles chosen by buildLandmarks
+	int numLandmarks;
+	int* landmarkDist; // landmarkDist[v * numLandmarks + i] is the distance from landmark i to v, INT_MAX if v cannot be reached
+	bool landmarksMapped; // landmark arrays point into compiled or another map instead of being allocated
+	int landmarkVersion; // mapVersion the distances are lower bounds for
+	void freeLandmarks();
+	void landmarkSearch(int source, int* dist, BucketQueue& frontier);
+	int* contractionRank; // order tiles were contracted in, -1 for tiles enemies cannot stand on
+	int* upOffsets; // edges from each tile to tiles contracted after it, laid out like edgeOffsets
+	int* upTargets;
+	int* upWeights; // doubled symmetric costs, see buildContraction
+	int* upMiddle; // tile a shortcut skips over, -1 for an edge between neighbouring tiles
+	int numUpEdges;
+	int numShortcuts;
+	int contractionVersion; // mapVersion the hierarchy was contracted for
+	bool contractionShared; // contraction arrays belong to another map
+	void freeContraction();
+	void witnessSearch(ContractionList* lists, int source, int skip, int first, int limit, SearchContext& context);
+	int contractTile(ContractionList* lists, int v, bool apply, SearchContext& context);
+	void addShortcut(ContractionList* lists, int u, int x, int weight, int middle);
+	int upwardMiddle(int u, int v);
+	bool stalled(const int* dist, const unsigned int* stamp, unsigned int epoch, int u);
+	int contractionStep(int source, int target, SearchContext& context);
+	IncrementalSearch* searches; // one per enemy, allocated the first time the enemy chases in CHASE_INCREMENTAL
+	int numSearches;
+	void freeSearches();
+	void initIncremental(IncrementalSearch& search, int start, int goal);
+	bool keyLess(int a1, int a2, int b1, int b2) { return a1 < b1 || (a1 == b1 && a2 < b2); }
+	void heapPlace(IncrementalSearch& search, int i, int vertex, int k1, int k2);
+	void heapSiftUp(IncrementalSearch& search, int i);
+	void heapSiftDown(IncrementalSearch& search, int i);
+	void heapRemove(IncrementalSearch& search, int vertex);
+	void requeue(IncrementalSearch& search, int vertex);
+	void updateVertex(IncrementalSearch& search, int vertex);
+	void computeShortestPath(IncrementalSearch& search);
+	int incrementalStep(int enemy);
+	void reserveSearches();
+	void moveEnemy(int enemy, int next);
+	void catchUser(int enemy, unsigned int random);
+	ThreadPool* pool; // planning threads for the parallel turn update, nullptr for the sequential update
+	SearchContext* contexts; // one per planning thread, the first one is also used outside of parallel turns
+	Instrumentation* stats; // counters to record into, nullptr when not measuring
+	EnemyPlan* plans;
+	int* waiting; // enemies whose plan waits on the enemy in their way, innermost last
+	atomic<int> chasePlans; // chases planned this turn
+	int plansSize;
+	int* reserved; // reservation table, an open addressing hash set of the tiles claimed this turn, -1 for an empty slot
+	int reservationSlots; // power of two, at least twice plansSize so probes stay short
+	bool claimTile(int tile);
+	unsigned int seed; // with the turn number and enemy index, decides every random choice of a parallel turn
+	int turn;
+	unsigned int enemyRandom(int enemy);
+	bool interactive; // false when running headless, catching the user then does not wait for a key or redraw
+	void planEnemy(int enemy, SearchContext& context);
+	void moveEnemiesParallel();
+	void applyPlan(int enemy, bool claimed);
 public:
 	Map() {
 		mapSize = 0;
 		numVertices = 0;
-		current = nullptr;
-		list = nullptr;
-		map = nullptr;
+		terrain = nullptr;
+		occupancy = nullptr;
+		terrainMapped = false;
+		terrainShared = false;
+		edgeOffsets = nullptr;
+		edgeTargets = nullptr;
+		edgeWeights = nullptr;
+		numEdges = 0;
+		edgesVersion = -1;
+		edgesMapped = false;
 		enemies = nullptr;
 		numEnemies = 0;
 		enemiesSize = 0;
 		hiddenTiles = nullptr;
 		hiddenSize = 0;
 		numHiddenTiles = 0;
+		maxWeight = 0;
+		minWeight = 0;
+		settled = 0;
+		queueType = AUTO_QUEUE;
+		graphType = IMPLICIT_GRID;
+		width = 0;
+		height = 0;
+		chaseMode = CHASE_DIJKSTRA;
+		mapVersion = 0;
+		flowDist = nullptr;
+		flowNext = nullptr;
+		flowTarget = -1;
+		flowVersion = -1;
+		pathCache = nullptr;
+		pathCacheVersion = -1;
+		clusterSize = 0;
+		clustersWide = 0;
+		clustersHigh = 0;
+		clusters = nullptr;
+		nodeSlot = nullptr;
+		hierarchyVersion = -1;
+		hierarchyShared = false;
+		component = nullptr;
+		componentTiles = nullptr;
+		componentBoxes = nullptr;
+		componentQueue = nullptr;
+		numComponents = 0;
+		componentsSize = 0;
+		liveComponents = 0;
+		componentVersion = -1;
+		componentsShared = false;
+		landmarks = nullptr;
+		numLandmarks = 0;
+		landmarkDist = nullptr;
+		landmarksMapped = false;
+		landmarkVersion = -1;
+		contractionRank = nullptr;
+		upOffsets = nullptr;
+		upTargets = nullptr;
+		upWeights = nullptr;
+		upMiddle = nullptr;
+		numUpEdges = 0;
+		numShortcuts = 0;
+		contractionVersion = -1;
+		contractionShared = false;
+		sight = nullptr;
+		enemyAt = nullptr;
+		sightVersion = -1;
+		sightShared = false;
+		searches = nullptr;
+		numSearches = 0;
+		pool = nullptr;
+		contexts = new SearchContext[1];
+		stats = nullptr;
+		plans = nullptr;
+		waiting = nullptr;
+		chasePlans = 0;
+		plansSize = 0;
+		reserved = nullptr;
+		reservationSlots = 0;
+		seed = 1;
+		turn = 0;
+		interactive = true;
 	}
 	Map(int n) {
 		mapSize = n;
 		numVertices = 0;
-		list = new Tile * [mapSize];
-		current = new Tile * [mapSize];
-		map = new Tile[mapSize];
-		for (int u = 0; u < n; u++) {
-			list[u] = nullptr;
-			current[u] = nullptr;
-		}
+		terrain = new unsigned char[(mapSize + 3) / 4];
+		occupancy = new unsigned char[mapSize];
+		terrainMapped = false;
+		terrainShared = false;
+		edgeOffsets = nullptr;
+		edgeTargets = nullptr;
+		edgeWeights = nullptr;
+		numEdges = 0;
+		edgesVersion = -1;
+		edgesMapped = false;
 		enemiesSize = 6;
 		numEnemies = 0;
 		enemies = new Characters[enemiesSize];
 		numHiddenTiles = 0;
 		hiddenSize = 8;
 		hiddenTiles = new int[hiddenSize];
+		maxWeight = 0;
+		minWeight = 0;
+		settled = 0;
+		queueType = AUTO_QUEUE;
+		graphType = IMPLICIT_GRID;
+		width = 0;
+		height = 0;
+		chaseMode = CHASE_DIJKSTRA;
+		mapVersion = 0;
+		flowDist = nullptr;
+		flowNext = nullptr;
+		flowTarget = -1;
+		flowVersion = -1;
+		pathCache = nullptr;
+		pathCacheVersion = -1;
+		clusterSize = 0;
+		clustersWide = 0;
+		clustersHigh = 0;
+		clusters = nullptr;
+		nodeSlot = nullptr;
+		hierarchyVersion = -1;
+		hierarchyShared = false;
+		component = nullptr;
+		componentTiles = nullptr;
+		componentBoxes = nullptr;
+		componentQueue = nullptr;
+		numComponents = 0;
+		componentsSize = 0;
+		liveComponents = 0;
+		componentVersion = -1;
+		componentsShared = false;
+		landmarks = nullptr;
+		numLandmarks = 0;
+		landmarkDist = nullptr;
+		landmarksMapped = false;
+		landmarkVersion = -1;
+		contractionRank = nullptr;
+		upOffsets = nullptr;
+		upTargets = nullptr;
+		upWeights = nullptr;
+		upMiddle = nullptr;
+		numUpEdges = 0;
+		numShortcuts = 0;
+		contractionVersion = -1;
+		contractionShared = false;
+		sight = nullptr;
+		enemyAt = nullptr;
+		sightVersion = -1;
+		sightShared = false;
+		searches = nullptr;
+		numSearches = 0;
+		pool = nullptr;
+		contexts = new SearchContext[1];
+		stats = nullptr;
+		plans = nullptr;
+		waiting = nullptr;
+		chasePlans = 0;
+		plansSize = 0;
+		reserved = nullptr;
+		reservationSlots = 0;
+		seed = 1;
+		turn = 0;
+		interactive = true;
 	}
 	~Map() {
-		for (int i = 0; i < mapSize; i++) {
-			Tile* current = list[i];
-			while (current) {
-				Tile* next = current->next;
-				delete current;
-				current = next;
-			}
-		}
-		delete[] list;
-		delete[] current;
-		delete[] map;
+		freeEdges();
+		freeTerrain();
+		delete[] occupancy;
 		delete[] enemies;
+		delete[] hiddenTiles;
+		delete[] flowDist;
+		delete[] flowNext;
+		delete pathCache;
+		freeHierarchy();
+		freeComponents();
+		freeLandmarks();
+		freeContraction();
+		freeSight();
+		freeEnemyIndex();
+		freeSearches();
+		delete pool;
+		delete[] contexts;
+		delete[] plans;
+		delete[] waiting;
+		delete[] reserved;
 	}
-	void expand();
 	void expandEnemies();
 	void expandHidden();
 	bool hasEdge(int u, int v);
 	double getWeight(int u, int v);
-	void setEdge(int u, int v, double w, char s);
 	void printList();
-	void mapFromFile(string filename);
+	void setQueueType(QueueType type) { queueType = type; }
+	void setGraphType(GraphType type) { graphType = type; } // call before mapToGraph
+	void setChaseMode(ChaseMode mode) { chaseMode = mode; }
+	void setPathCache(int entries); // caches the steps of this many (source, target) pairs, 0 turns caching off
+	long long getPathCacheHits() { return pathCache ? pathCache->hits.load() : 0; }
+	long long getPathCacheMisses() { return pathCache ? pathCache->misses.load() : 0; }
+	void buildHierarchy(int size);
+	void buildLandmarks(int count);
+	int getNumLandmarks() { return (landmarkVersion == mapVersion) ? numLandmarks : 0; }
+	long long getLandmarkBytes() { return (long long)numLandmarks * numVertices * sizeof(int); }
+	void buildContraction();
+	int getNumShortcuts() { return (contractionVersion == mapVersion) ? numShortcuts : 0; }
+	long long getContractionBytes() { return (contractionVersion == mapVersion) ? (2LL * numVertices + 1) * sizeof(int) + 3LL * numUpEdges * sizeof(int) : 0; }
+	int getNumComponents() { return (componentVersion == mapVersion) ? liveComponents : 0; } // built by mapToGraph
+	int getComponentLabels() { return (componentVersion == mapVersion) ? numComponents : 0; } // dead labels have no tiles
+	int componentOf(int vertex) { return (componentVersion == mapVersion) ? component[vertex] : -1; }
+	int getComponentSize(int c) { return componentTiles[c]; }
+	ComponentBox getComponentBox(int c) { return componentBoxes[c]; }
+	bool mayReach(int source, int target);
+	void setTile(int vertex, char symbol);
+	int getSettled() { return settled; }
+	void setThreads(int threads); // 0 keeps the original one-by-one update, otherwise plans enemies on this many threads
+	void setSeed(unsigned int value) { seed = value; }
+	void setInteractive(bool value) { interactive = value; }
+	void setInstrumentation(Instrumentation* value) { stats = value; }
+	int pathStep(int source, int target);
+	int getNumVertices() { return numVertices; }
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+	int getUserVertex() { return user.vertex; }
+	int getNumEnemies() { return numEnemies; }
+	int getEnemyVertex(int enemy) { return enemies[enemy].vertex; }
+	int enemyOn(int vertex);
+	char tileAt(int vertex) { return TERRAIN_SYMBOLS[terrainCode(vertex)]; } // terrain, ignoring any character on it
+	int terrainAt(int vertex) { return terrainCode(vertex); }
+	char symbolAt(int vertex) { return (occupancy[vertex] == OCCUPANT_USER) ? 'O' : (occupancy[vertex] == OCCUPANT_ENEMY) ? '#' : tileAt(vertex); }
+	void mapFromFile(string filename, bool useCompiled = true);
+	void prepareSharing(); // builds what every session of this map would otherwise build for itself, see shareFrom
+	void shareFrom(Map& source);
 	void mapToGraph();
+	bool saveCompiled(string filename);
 	void printMap();
 	void moveEnemies();
 	void move(char direction);
 	void reset();
 };
 
-void Map::expand() { // map is of dynamic size
-	mapSize *= 2;
-	Tile* temp = new Tile[mapSize];
-	for (int i = 0; i < numVertices; i++) {
-		temp[i] = map[i];
+class FrameRenderer { // draws the map by writing only the tiles that changed since the last frame, in one write per frame
+private:
+	char* frame; // symbols currently on screen, 0 where nothing has been drawn yet
+	int frameWidth; // size of the drawn window in tiles
+	int frameHeight;
+	int viewWidth; // largest window that fits in the terminal, maps bigger than this scroll with the user
+	int viewHeight;
+	int originX; // map tile shown in the top left corner
+	int originY;
+	unsigned int clears; // ScreenClears() when the frame was drawn
+	string buffer; // escape sequences and symbols of the frame being drawn
+	void scroll(int& origin, int position, int view, int size);
+public:
+	FrameRenderer();
+	~FrameRenderer() { delete[] frame; }
+	void setViewport(int width, int height);
+	void fitTerminal();
+	void invalidate() { frameWidth = 0; }
+	void draw(Map& map);
+	size_t lastFrameBytes() { return buffer.size(); }
+};
+
+void BinaryHeap::expand() {
+	capacity *= 2;
+	int* tempKeys = new int[capacity];
+	int* tempVertices = new int[capacity];
+	for (int i = 0; i < size; i++) {
+		tempKeys[i] = keys[i];
+		tempVertices[i] = vertices[i];
 	}
-	delete[] map;
-	map = temp;
-	delete[] temp;
+	delete[] keys;
+	delete[] vertices;
+	keys = tempKeys;
+	vertices = tempVertices;
 }
 
-void Map::expandEnemies() { // enemy array is dynamic
-	enemiesSize *= 2;
-	Characters* temp = new Characters[enemiesSize];
-	for (int i = 0; i < numEnemies; i++) {
-		temp[i] = enemies[i];
+void BinaryHeap::swap(int a, int b) {
+	int tempKey = keys[a], tempVertex = vertices[a];
+	keys[a] = keys[b];
+	vertices[a] = vertices[b];
+	keys[b] = tempKey;
+	vertices[b] = tempVertex;
+}
+
+void BinaryHeap::push(int vertex, int key) { // duplicates are allowed, stale entries are skipped by the search when popped
+	if (size == capacity) { expand(); }
+	int i = size++;
+	keys[i] = key;
+	vertices[i] = vertex;
+	while (i > 0 && keys[(i - 1) / 2] > keys[i]) { // sift up
+		swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
 	}
-	delete[] enemies;
-	enemies = temp;
-	delete[] temp;
 }
 
-void Map::expandHidden() { // hidden tile array is dynamic
-	hiddenSize *= 2;
-	int* temp = new int[hiddenSize];
-	for (int i = 0; i < numHiddenTiles; i++) {
-		temp[i] = hiddenTiles[i];
+int BinaryHeap::pop() {
+	int top = vertices[0];
+	size--;
+	keys[0] = keys[size];
+	vertices[0] = vertices[size];
+	int i = 0;
+	while (true) { // sift down
+		int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+		if (left < size && keys[left] < keys[smallest]) { smallest = left; }
+		if (right < size && keys[right] < keys[smallest]) { smallest = right; }
+		if (smallest == i) { break; }
+		swap(i, smallest);
+		i = smallest;
 	}
-	delete[] hiddenTiles;
-	hiddenTiles = temp;
-	delete[] temp;
+	return top;
 }
 
-bool Map::hasEdge(int u, int v) { // checks adjacency list to see if there is an edge between vertex u and vertex v
-	if (u < numVertices) {
-		Tile* cursor = list[u];
-		while (cursor) {
-			if (cursor->vertex == v) { return true; }
-			else { cursor = cursor->next; }
-		}
-		return false;
+void BucketQueue::expandBucket(int b) {
+	bucketCapacities[b] *= 2;
+	int* temp = new int[bucketCapacities[b]];
+	for (int i = 0; i < bucketSizes[b]; i++) {
+		temp[i] = buckets[b][i];
 	}
-	else { return false; }
+	delete[] buckets[b];
+	buckets[b] = temp;
 }
 
-double Map::getWeight(int u, int v) { // gets edge weight between two vertices
-	if (u < numVertices) {
-		Tile* cursor = list[u];
-		while (cursor) {
-			if (cursor->vertex == v) { return cursor->weight; }
-			else { cursor = cursor->next; }
+void BucketQueue::push(int vertex, int key) {
+	int b = key % numBuckets;
+	if (bucketSizes[b] == bucketCapacities[b]) { expandBucket(b); }
+	buckets[b][bucketSizes[b]++] = vertex;
+	count++;
+}
+
+int BucketQueue::pop() { // every key in the queue lies within numBuckets of the smallest one, so the cursor only moves forward
+	while (bucketSizes[cursor] == 0) { cursor = (cursor + 1) % numBuckets; }
+	count--;
+	return buckets[cursor][--bucketSizes[cursor]];
+}
+
+void BucketQueue::clear() {
+	for (int i = 0; i < numBuckets; i++) { bucketSizes[i] = 0; }
+	cursor = 0;
+	count = 0;
+}
+
+void BucketQueue::widen(int maxWeight) {
+	if (maxWeight + 1 > numBuckets) {
+		for (int i = 0; i < numBuckets; i++) { delete[] buckets[i]; }
+		delete[] buckets;
+		delete[] bucketSizes;
+		delete[] bucketCapacities;
+		numBuckets = maxWeight + 1;
+		buckets = new int* [numBuckets];
+		bucketSizes = new int[numBuckets];
+		bucketCapacities = new int[numBuckets];
+		for (int i = 0; i < numBuckets; i++) {
+			bucketCapacities[i] = 16;
+			buckets[i] = new int[bucketCapacities[i]];
 		}
-		return 0;
 	}
-	else { return 0; }
+	clear();
+}
+// a new epoch invalidates every entry at once, the stamps only have to be cleared when the epoch wraps around
+void SearchContext::begin(int vertices) {
+	if (vertices > capacity) {
+		delete[] dist;
+		delete[] pi;
+		delete[] stamp;
+		capacity = vertices;
+		dist = new int[capacity]; // only read where the stamp says they were written in this search
+		pi = new int[capacity];
+		stamp = new unsigned int[capacity]();
+		epoch = 0;
+	}
+	if (epoch >= UINT_MAX - 2) {
+		for (int i = 0; i < capacity; i++) { stamp[i] = 0; }
+		epoch = 0;
+	}
+	epoch += 2;
 }
 
-void Map::setEdge(int u, int v, double w, char s) { // creates a directed edge between two vertices if an edge between them doesn't already exist.
-	if (!hasEdge(u, v)) {
-		Tile* temp = new Tile(v, w, s);
-		temp->next = list[u];
-		list[u] = temp;
+void SearchContext::beginAbstract(int ids) {
+	if (ids > abstractCapacity) {
+		delete[] abstractDist;
+		delete[] abstractPrev;
+		delete[] abstractStamp;
+		abstractCapacity = ids;
+		abstractDist = new int[abstractCapacity];
+		abstractPrev = new int[abstractCapacity];
+		abstractStamp = new unsigned int[abstractCapacity]();
+		abstractEpoch = 0;
+	}
+	if (abstractEpoch >= UINT_MAX - 2) {
+		for (int i = 0; i < abstractCapacity; i++) { abstractStamp[i] = 0; }
+		abstractEpoch = 0;
 	}
+	abstractEpoch += 2;
+	abstractPushes = 0;
 }
 
-void Map::printList() { // prints adjacency list
-	for (int u = 0; u < numVertices; u++) {
-		cout << "| " << u << ":";
-		Tile* cursor = list[u];
-		while (cursor) {
-			cout << " " << cursor->vertex << "(" << cursor->weight << ")";
-			cursor = cursor->next;
-		}
-		cout << "\n";
+void SearchContext::beginBackward(int vertices) {
+	if (vertices > backwardCapacity) {
+		delete[] backwardDist;
+		delete[] backwardPi;
+		delete[] backwardStamp;
+		backwardCapacity = vertices;
+		backwardDist = new int[backwardCapacity];
+		backwardPi = new int[backwardCapacity];
+		backwardStamp = new unsigned int[backwardCapacity]();
+		backwardEpoch = 0;
+	}
+	if (backwardEpoch >= UINT_MAX - 2) {
+		for (int i = 0; i < backwardCapacity; i++) { backwardStamp[i] = 0; }
+		backwardEpoch = 0;
 	}
+	backwardEpoch += 2;
 }
 
-void Map::mapFromFile(string filename) { // fills map array with map from a file
-	ifstream inFS(filename);
-	char temp;
-	while (inFS >> temp) {
-		if (numVertices == mapSize) { expand(); } // expands map size in case it does not have room for an element
-		double tempWeight;
-		if (temp == 'X') { tempWeight = 0; }
-		else if (temp == '-') { tempWeight = 2; }
-		else { tempWeight = 1; }
-		Tile tempTile(numVertices, tempWeight, (temp == '_') ? ' ' : temp); // '_' in text file represents plain terrain in the map
-		tempTile.pi = -1; // sets predecessor to -1
-		map[numVertices] = tempTile;
-		if (tempTile.symbol == 'H') { // loads the array containing vertices of all hidden tiles
-			if (numHiddenTiles == hiddenSize) { expandHidden(); }
-			hiddenTiles[numHiddenTiles] = numVertices;
-			numHiddenTiles++;
-		}
-		if (tempTile.symbol == 'O') { // sets values for user
-			user.vertex = numVertices;
-			user.tile = ' ';
-			user.seesUser = false;
-			user.counter = 0;
-		}
-		if (tempTile.symbol == '#') { // adds each enemy to the enemy array
-			if (numEnemies == enemiesSize) { expandEnemies(); }
-			Characters temp;
-			temp.vertex = numVertices;
-			temp.tile = ' ';
-			temp.seesUser = false;
-			temp.counter = 0;
-			enemies[numEnemies] = temp;
-			numEnemies++;
-		}
-		numVertices++;
+void SearchContext::reserveDense(int vertices) {
+	if (vertices <= denseCapacity) { return; }
+	delete[] denseKey;
+	delete[] denseBlockMin;
+	delete[] denseGroupMin;
+	denseCapacity = (vertices + 511) / 512 * 512;
+	denseKey = new int[denseCapacity];
+	denseBlockMin = new int[denseCapacity / 8];
+	denseGroupMin = new int[denseCapacity / 64];
+	for (int i = 0; i < denseCapacity; i++) { denseKey[i] = INT_MAX; }
+	for (int i = 0; i < denseCapacity / 8; i++) { denseBlockMin[i] = INT_MAX; }
+	for (int i = 0; i < denseCapacity / 64; i++) { denseGroupMin[i] = INT_MAX; }
+}
+
+void SearchContext::tracePath(int source, int target) {
+	bool found = isSettled(target);
+	int length = 1;
+	if (found) {
+		for (int v = target; v != source; v = pi[v]) { length++; }
+	}
+	if (length > pathSize) {
+		delete[] path;
+		pathSize = length;
+		path = new int[pathSize];
+	}
+	pathLength = length;
+	pathTarget = target;
+	path[0] = source;
+	if (found) {
+		for (int v = target, i = length - 1; i > 0; v = pi[v], i--) { path[i] = v; }
 	}
-	inFS.close();
 }
 
-void Map::mapToGraph() { // converts map array into a graph
-	int rows = sqrt(numVertices);
-	for (int u = 0; u < mapSize; u++) { // iterates through all tiles in map and checks if there is a tile you can move to from there
-		int left = u - 1, right = u + 1, up = u - rows, down = u + rows;
-		if (map[u].symbol != 'X') {
-			if (left >= 0 && map[left].symbol != 'X') { // checks left tile
-				setEdge(u, left, map[left].weight, map[left].symbol);
-			}
-			if (right < numVertices && map[right].symbol != 'X') { // checks right tile
-				setEdge(u, right, map[right].weight, map[right].symbol);
-			}
-			if (up >= 0 && map[up].symbol != 'X') { // checks above tile
-				setEdge(u, up, map[up].weight, map[up].symbol);
-			}
-			if (down < numVertices && map[down].symbol != 'X') { // checks below tile
-				setEdge(u, down, map[down].weight, map[down].symbol);
-			}
-		}
+PathCache::PathCache(int capacity) {
+	numSets = 1;
+	while (numSets * PATH_CACHE_WAYS < capacity) { numSets *= 2; }
+	entries = new PathEntry[numSets * PATH_CACHE_WAYS];
+	victim = new unsigned char[numSets]();
+	for (int i = 0; i < numSets * PATH_CACHE_WAYS; i++) { entries[i].generation = -1; }
+	mark = nullptr;
+	markSize = 0;
+	generation = 0;
+	hits = 0;
+	misses = 0;
+}
+
+void PathCache::clear(int vertices) {
+	if (vertices > markSize) {
+		delete[] mark;
+		markSize = vertices;
+		mark = new int[markSize];
+		for (int i = 0; i < markSize; i++) { mark[i] = -1; }
 	}
+	generation++;
 }
 
-void Map::printMap() { // prints map
-	int counter = 0;
-	cout << "\t";
-	for (int i = 0; i < numVertices; i++) {
-		// Color changes are only available on Windows OS, please comment out or delete the lines that correspond to color changes if on another OS
-		// Sets colors based on type of tile
-		if (map[i].symbol == 'X') { SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 8); } // gray
-		if (map[i].symbol == '#') { SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 4); } // red
-		if (map[i].symbol == '-') { SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 2); } // green
-		if (map[i].symbol == 'O') { SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 14); } // tan
-		if (map[i].symbol == 'H') { SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 11); } // cyan
-		cout << map[i].symbol << " ";
-		counter++;
-		if (counter == sqrt(numVertices)) { // displays map array as 2d array by inserting a newline after a row is completed
-			cout << "\n\t";
-			counter = 0;
+int PathCache::find(int source, int target) {
+	PathEntry* set = entries + setOf(source, target) * PATH_CACHE_WAYS;
+	for (int way = 0; way < PATH_CACHE_WAYS; way++) {
+		if (set[way].generation == generation && set[way].source == source && set[way].target == target) {
+			hits++;
+			return set[way].next;
 		}
-		SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 15); // resets text color to white
 	}
+	misses++;
+	return -1;
 }
-
-int Map::minDistance(int* dist, bool* visited) { // used in Dijkstra's algorithm for selecting the next vertex
-	int minIndex = -1;
-	int min = INT_MAX;
-
-	for (int i = 0; i < numVertices; i++) {
-		if (visited[i] == false && dist[i] <= min) {
-			min = dist[i];
-			minIndex = i;
+// a path of one tile means target could not be reached from it. Every tile is marked, while only the first
+// PATH_CACHE_STEPS steps are cached, since each step's entry is only right while the whole rest of the path is.
+void PathCache::store(const int* path, int length, int target) {
+	for (int i = 0; i < length; i++) {
+		if (path[i] < markSize) { mark[path[i]] = generation; }
+	}
+	int steps = (length > 1) ? length - 1 : 1;
+	for (int i = 0; i < steps && i < PATH_CACHE_STEPS; i++) {
+		int source = path[i];
+		int s = setOf(source, target);
+		PathEntry* set = entries + s * PATH_CACHE_WAYS;
+		int way = 0;
+		while (way < PATH_CACHE_WAYS && set[way].generation == generation && !(set[way].source == source && set[way].target == target)) { way++; }
+		if (way == PATH_CACHE_WAYS) { // full, replaces the oldest
+			way = victim[s];
+			victim[s] = (unsigned char)((way + 1) % PATH_CACHE_WAYS);
 		}
+		set[way].source = source;
+		set[way].target = target;
+		set[way].next = (length > 1) ? path[i + 1] : source;
+		set[way].generation = generation;
 	}
-	return minIndex;
 }
-// modified Dijkstra's algorithm that finds the path from a source to a target
-int Map::Dijkstra(int source, int target) {
-	int* dist = new int[numVertices];
-	bool* visited = new bool[numVertices];
-	bool done = false;
 
-	for (int i = 0; i < numVertices; i++) {
-		dist[i] = INT_MAX;
-		visited[i] = false;
+bool MappedFile::open(string filename, bool copyOnWrite) {
+	close();
+#ifdef _WIN32
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+			mapping = CreateFileMappingA(file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+			if (mapping) { data = (const char*)MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0); }
+			size = (size_t)fileSize.QuadPart;
+		}
+		if (data) { return true; }
 	}
-
-	dist[source] = 0;
-
-	for (int count = 0; count < numVertices - 1; count++) {
-		int u = minDistance(dist, visited);
-		visited[u] = true;
-		if (!done) {
-			for (int v = 0; v < numVertices; v++) {
-				if (!visited[v] && hasEdge(u, v) && dist[u] != INT_MAX && dist[u] + getWeight(u, v) < dist[v] && map[v].symbol != 'H') {
-					dist[v] = dist[u] + getWeight(u, v);
-					map[v].pi = u;
-				}
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0) {
+			void* view = mmap(nullptr, (size_t)info.st_size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+			if (view != MAP_FAILED) {
+				data = (const char*)view;
+				size = (size_t)info.st_size;
+				madvise(view, size, MADV_SEQUENTIAL);
 			}
 		}
-		if (u == target) { done = true; }
+		::close(fd);
+		if (data) { return true; }
 	}
-	int next = map[target].pi;
-	while (map[next].pi != source) { next = map[next].pi; } // backtracks through each predecessor until the next step is calculated
-	return next;
+#endif
+	close();
+	ifstream inFS(filename, ios::binary | ios::ate); // mapping is not available, so the file is read in one go instead
+	if (!inFS) { return false; }
+	size = (size_t)inFS.tellg();
+	buffer = new char[size + 1];
+	inFS.seekg(0);
+	inFS.read(buffer, size);
+	data = buffer;
+	return true;
 }
-// function to check if character can move in a certain direction
-bool Map::canMove(int vertex, int direction) {
-	int rows = sqrt(numVertices);
 
-	if (direction == 0) { // up
-		int up = vertex - rows;
-		if (up >= 0 && (map[up].symbol == ' ' || map[up].symbol == '-')) { return true; }
+void MappedFile::close() {
+	if (data && !buffer) {
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap((void*)data, size);
+#endif
 	}
-	else if (direction == 1) { // down
-		int down = vertex + rows;
-		if (down < numVertices && (map[down].symbol == ' ' || map[down].symbol == '-')) { return true; }
-	}
-	else if (direction == 2) { // left
-		int left = vertex - 1;
-		if (left >= 0 && (map[left].symbol == ' ' || map[left].symbol == '-')) { return true; }
-	}
-	else { // right
-		int right = vertex + 1;
-		if (right < numVertices && (map[right].symbol == ' ' || map[right].symbol == '-')) { return true; }
+#ifdef _WIN32
+	if (mapping) { CloseHandle(mapping); }
+	if (file != INVALID_HANDLE_VALUE) { CloseHandle(file); }
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#endif
+	delete[] buffer;
+	buffer = nullptr;
+	data = nullptr;
+	size = 0;
+}
+// class of every byte a map file can contain, whitespace and anything unprintable is TILE_NONE and skipped
+const unsigned char* TileClasses() {
+	static unsigned char table[256];
+	static bool built = false;
+	if (!built) {
+		for (int c = 0; c < 256; c++) { table[c] = (c > ' ' && c < 127) ? TILE_OTHER : TILE_NONE; }
+		for (int code = 0; code < NUM_TERRAIN; code++) { table[(unsigned char)TERRAIN_RULES[code].fileSymbol] = (unsigned char)(TILE_TERRAIN + code); }
+		table['O'] = TILE_PLAYER;
+		table['#'] = TILE_ENEMY;
+		built = true;
 	}
+	return table;
+}
 
-	return false;
+string CompiledName(string filename) { // compiled maps sit next to their text form with a .bin extension
+	size_t dot = filename.find_last_of('.');
+	size_t slash = filename.find_last_of("/\\");
+	if (dot == string::npos || (slash != string::npos && dot < slash)) { return filename + ".bin"; }
+	return filename.substr(0, dot) + ".bin";
 }
-// used for user movement since user can move to hidden tiles as well as where enemies can
-bool Map::adjacentHidden(int vertex, int direction) {
-	int rows = sqrt(numVertices);
 
-	if (direction == 0) { // up
-		int up = vertex - rows;
-		if (up >= 0 && (map[up].symbol == 'H')) { return true; }
-	}
-	else if (direction == 1) { // down
-		int down = vertex + rows;
-		if (down < numVertices && (map[down].symbol == 'H')) { return true; }
+bool IsUpToDate(string compiledName, string source) { // true if compiledName exists and is at least as new as source
+	struct stat compiledInfo, sourceInfo;
+	if (stat(compiledName.c_str(), &compiledInfo) != 0) { return false; }
+	if (stat(source.c_str(), &sourceInfo) != 0) { return true; } // only the compiled map is around
+	return compiledInfo.st_mtime >= sourceInfo.st_mtime;
+}
+
+void ThreadPool::run(int count, function<void(int, int)> task) {
+	for (int i = 0; i < numThreads; i++) { // splits the tasks evenly, stealing evens out whatever is uneven
+		ranges[i].begin = (int)((long long)count * i / numThreads);
+		ranges[i].end = (int)((long long)count * (i + 1) / numThreads);
 	}
-	else if (direction == 2) { // left
-		int left = vertex - 1;
-		if (left >= 0 && (map[left].symbol == 'H')) { return true; }
+	{
+		lock_guard<mutex> guard(jobLock);
+		job = task;
+		busy = numThreads - 1;
+		generation++;
 	}
-	else { // right
-		int right = vertex + 1;
-		if (right < numVertices && (map[right].symbol == 'H')) { return true; }
+	jobReady.notify_all();
+	work(0);
+	unique_lock<mutex> guard(jobLock);
+	jobDone.wait(guard, [this] { return busy == 0; });
+}
+
+void Histogram::clear() {
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++) { buckets[i] = 0; }
+	count = 0;
+	total = 0;
+	largest = 0;
+}
+
+void Histogram::add(long long value) {
+	int bucket = 0;
+	while (bucket < HISTOGRAM_BUCKETS - 1 && (1LL << bucket) <= value) { bucket++; }
+	buckets[bucket].fetch_add(1, memory_order_relaxed);
+	count.fetch_add(1, memory_order_relaxed);
+	total.fetch_add(value, memory_order_relaxed);
+	long long seen = largest.load(memory_order_relaxed);
+	while (value > seen && !largest.compare_exchange_weak(seen, value, memory_order_relaxed)) {}
+}
+// CSV rows are name,low,high,count for each non-empty bucket, JSON is one object with the totals and the non-empty buckets
+bool Histogram::write(ostream& out, const char* name, bool csv) {
+	if (!csv) { out << "    \"" << name << "\": { \"count\": " << count << ", \"total\": " << total << ", \"max\": " << largest << ", \"buckets\": ["; }
+	bool first = true;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if (buckets[i] == 0) { continue; }
+		long long low = (i == 0) ? 0 : 1LL << (i - 1), high = (i == 0) ? 0 : (1LL << i) - 1;
+		if (i == HISTOGRAM_BUCKETS - 1) { high = LLONG_MAX; }
+		if (csv) { out << name << "," << low << "," << high << "," << buckets[i] << "\n"; }
+		else {
+			out << (first ? " " : ", ") << "[" << low << ", " << high << ", " << buckets[i] << "]";
+			first = false;
+		}
+	}
+	if (!csv) { out << " ] }"; }
+	return out.good();
+}
+
+void Instrumentation::clear() {
+	searchSettled.clear();
+	searchRelaxed.clear();
+	searchQueueOps.clear();
+	queryNanos.clear();
+	turnNanos.clear();
+	movementNanos.clear();
+	visibilityNanos.clear();
+	pathingNanos.clear();
+	renderingNanos.clear();
+	edgeLookups = 0;
+	turnStart = 0;
+	turnVisibility = 0;
+	turnPathing = 0;
+	turnRendering = 0;
+}
+
+void Instrumentation::recordSearch(int settled, int relaxed, int queueOps) {
+	searchSettled.add(settled);
+	searchRelaxed.add(relaxed);
+	searchQueueOps.add(queueOps);
+}
+
+void Instrumentation::beginTurn() {
+	turnVisibility = 0;
+	turnPathing = 0;
+	turnRendering = 0;
+	turnStart = NowNanos();
+}
+
+void Instrumentation::endTurn() {
+	long long elapsed = NowNanos() - turnStart;
+	long long movement = elapsed - turnVisibility - turnPathing - turnRendering;
+	turnNanos.add(elapsed);
+	movementNanos.add((movement > 0) ? movement : 0); // the phases are timed on their own, so they can round to more than the turn
+	visibilityNanos.add(turnVisibility);
+	pathingNanos.add(turnPathing);
+	renderingNanos.add(turnRendering);
+}
+
+bool Instrumentation::dump(string filename) {
+	ofstream outFS(filename);
+	if (!outFS.is_open()) { return false; }
+	bool csv = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".csv") == 0;
+	Histogram* histograms[] = { &searchSettled, &searchRelaxed, &searchQueueOps, &queryNanos, &turnNanos, &movementNanos,
+		&visibilityNanos, &pathingNanos, &renderingNanos };
+	const char* names[] = { "search_settled", "search_relaxed", "search_queue_ops", "query_ns", "turn_ns", "movement_ns",
+		"visibility_ns", "pathing_ns", "rendering_ns" };
+	if (csv) {
+		outFS << "name,low,high,count\n";
+		outFS << "edge_lookups,,," << edgeLookups << "\n";
+	}
+	else { outFS << "{\n  \"instrumentation\": " << (INSTRUMENTATION ? "true" : "false") << ",\n  \"edge_lookups\": " << edgeLookups << ",\n  \"histograms\": {\n"; }
+	for (int i = 0; i < 9; i++) {
+		histograms[i]->write(outFS, names[i], csv);
+		if (!csv) { outFS << ((i < 8) ? ",\n" : "\n"); }
+	}
+	if (!csv) { outFS << "  }\n}\n"; }
+	return outFS.good();
+}
+
+bool ThreadPool::take(int self, int& task) {
+	lock_guard<mutex> guard(ranges[self].lock);
+	if (ranges[self].begin >= ranges[self].end) { return false; }
+	task = ranges[self].begin++;
+	return true;
+}
+
+bool ThreadPool::steal(int self) { // moves the back half of another worker's tasks into this worker's empty range
+	for (int k = 1; k < numThreads; k++) {
+		Range& victim = ranges[(self + k) % numThreads];
+		int begin, end;
+		{
+			lock_guard<mutex> guard(victim.lock);
+			int remaining = victim.end - victim.begin;
+			if (remaining <= 0) { continue; }
+			end = victim.end;
+			begin = end - (remaining + 1) / 2;
+			victim.end = begin;
+		}
+		lock_guard<mutex> guard(ranges[self].lock);
+		ranges[self].begin = begin;
+		ranges[self].end = end;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::work(int self) {
+	int task;
+	while (take(self, task) || (steal(self) && take(self, task))) { job(task, self); }
+}
+
+void ThreadPool::workerLoop(int self) {
+	int seen = 0;
+	while (true) {
+		{
+			unique_lock<mutex> guard(jobLock);
+			jobReady.wait(guard, [this, seen] { return stopping || generation != seen; });
+			if (stopping) { return; }
+			seen = generation;
+		}
+		work(self);
+		{
+			lock_guard<mutex> guard(jobLock);
+			busy--;
+		}
+		jobDone.notify_all();
+	}
+}
+
+void Map::expandEnemies() { // enemy array is dynamic
+	enemiesSize *= 2;
+	Characters* temp = new Characters[enemiesSize];
+	for (int i = 0; i < numEnemies; i++) {
+		temp[i] = enemies[i];
+	}
+	delete[] enemies;
+	enemies = temp;
+}
+
+void Map::expandHidden() { // hidden tile array is dynamic
+	hiddenSize *= 2;
+	int* temp = new int[hiddenSize];
+	for (int i = 0; i < numHiddenTiles; i++) {
+		temp[i] = hiddenTiles[i];
+	}
+	delete[] hiddenTiles;
+	hiddenTiles = temp;
+}
+
+void Map::reserve(int tiles, int enemyCount, int hiddenCount) { // makes room for a whole map at once when its size is known up front
+	if (tiles > mapSize) {
+		freeTerrain();
+		delete[] occupancy;
+		mapSize = tiles;
+		occupancy = new unsigned char[mapSize];
+	}
+	if (!terrain) { terrain = new unsigned char[(mapSize + 3) / 4]; }
+	if (enemyCount > enemiesSize) {
+		delete[] enemies;
+		enemiesSize = enemyCount;
+		enemies = new Characters[enemiesSize];
+	}
+	if (hiddenCount > hiddenSize) {
+		delete[] hiddenTiles;
+		hiddenSize = hiddenCount;
+		hiddenTiles = new int[hiddenSize];
+	}
+}
+
+// left, right, up and down, the order ties between equally short paths are broken in
+EdgeSpan GridGraph::edges(int u, EdgeBuffer& buffer) const {
+	int count = 0;
+	if (HasRule(EDGE_TERRAIN, TerrainAt(terrain, u))) {
+		int column = u % width;
+		int neighbours[4] = { column > 0 ? u - 1 : -1, column < width - 1 ? u + 1 : -1, u - width, u + width };
+		for (int i = 0; i < 4; i++) {
+			int v = neighbours[i];
+			if (v >= 0 && v < width * height && HasRule(EDGE_TERRAIN, TerrainAt(terrain, v))) {
+				buffer.targets[count] = v;
+				buffer.weights[count] = (unsigned char)TERRAIN_WEIGHTS[TerrainAt(terrain, v)];
+				count++;
+			}
+		}
+	}
+	return { buffer.targets, buffer.weights, count };
+}
+
+int Map::neighbour(int vertex, int direction) { // tile next to vertex in a direction (0 up, 1 down, 2 left, 3 right), -1 if off the map
+	int column = vertex % width;
+	if (direction == 0) { return vertex - width >= 0 ? vertex - width : -1; }
+	else if (direction == 1) { return vertex + width < numVertices ? vertex + width : -1; }
+	else if (direction == 2) { return column > 0 ? vertex - 1 : -1; }
+	else { return column < width - 1 ? vertex + 1 : -1; }
+}
+
+EdgeSpan Map::edges(int u, EdgeBuffer& buffer) {
+	if (graphType == CSR_GRAPH) { return csrView().edges(u, buffer); }
+	return gridView().edges(u, buffer);
+}
+
+bool Map::hasEdge(int u, int v) { // checks u's edge span to see if there is an edge between vertex u and vertex v
+	PROBE(if (stats) { stats->edgeLookups.fetch_add(1, memory_order_relaxed); })
+	if (u < numVertices && (graphType == IMPLICIT_GRID || edgeOffsets)) {
+		EdgeBuffer buffer;
+		EdgeSpan span = edges(u, buffer);
+		for (int i = 0; i < span.count; i++) {
+			if (span.targets[i] == v) { return true; }
+		}
+	}
+	return false;
+}
+
+double Map::getWeight(int u, int v) { // gets edge weight between two vertices
+	if (u < numVertices && (graphType == IMPLICIT_GRID || edgeOffsets)) {
+		EdgeBuffer buffer;
+		EdgeSpan span = edges(u, buffer);
+		for (int i = 0; i < span.count; i++) {
+			if (span.targets[i] == v) { return span.weights[i]; }
+		}
+	}
+	return 0;
+}
+
+void Map::printList() { // prints adjacency list
+	for (int u = 0; u < numVertices; u++) {
+		cout << "| " << u << ":";
+		EdgeBuffer buffer;
+		EdgeSpan span = edges(u, buffer);
+		for (int i = 0; i < span.count; i++) {
+			cout << " " << span.targets[i] << "(" << (int)span.weights[i] << ")";
+		}
+		cout << "\n";
+	}
+}
+
+// fills map array with map from a file, one row of tiles per line. An optional first line "width height" allows the
+// rows to be wrapped any way, otherwise the first row sets the width. The file is mapped and scanned twice, once to
+// size every array exactly and once to fill them. A compiled copy of the map made by saveCompiled is loaded instead
+// when there is one that is not older than the text file.
+void Map::mapFromFile(string filename, bool useCompiled) {
+	mapVersion++;
+	numVertices = 0;
+	numEnemies = 0;
+	numHiddenTiles = 0;
+	width = 0;
+	height = 0;
+	closeCompiled();
+	freeEnemyIndex();
+	string compiledName = CompiledName(filename);
+	if (useCompiled && IsUpToDate(compiledName, filename) && loadCompiled(compiledName)) { return; }
+	if (compiledName == filename) { return; } // a .bin file that is not a valid compiled map
+	MappedFile file;
+	if (!file.open(filename)) { return; }
+	const unsigned char* classes = TileClasses();
+	const char* cursor = file.data;
+	const char* end = file.data + file.size;
+
+	while (cursor < end && isspace((unsigned char)*cursor)) { cursor++; }
+	int headerWidth = 0, headerHeight = 0;
+	if (cursor < end && isdigit((unsigned char)*cursor)) { // dimensions header
+		while (cursor < end && isdigit((unsigned char)*cursor)) { headerWidth = headerWidth * 10 + (*cursor++ - '0'); }
+		while (cursor < end && (*cursor == ' ' || *cursor == '\t')) { cursor++; }
+		while (cursor < end && isdigit((unsigned char)*cursor)) { headerHeight = headerHeight * 10 + (*cursor++ - '0'); }
+		while (cursor < end && *cursor != '\n') { cursor++; }
+	}
+
+	long long counts[NUM_TILE_CLASSES] = { 0 };
+	long long firstRow = -1, row = 0;
+	bool ragged = false;
+	for (const char* c = cursor; c <= end; c++) { // pre-pass counts every class so nothing has to grow later
+		if (c == end || *c == '\n') { // without a header every line is a row as long as the first, blank lines are skipped
+			if (row > 0 && firstRow < 0) { firstRow = row; }
+			else if (row > 0 && row != firstRow) { ragged = true; }
+			row = 0;
+			continue;
+		}
+		unsigned char type = classes[(unsigned char)*c];
+		counts[type]++;
+		if (type != TILE_NONE) { row++; }
+	}
+	long long tiles = 0;
+	for (int type = TILE_TERRAIN; type < NUM_TILE_CLASSES; type++) { tiles += counts[type]; }
+	long long rowLength = (headerWidth > 0) ? headerWidth : firstRow; // a header lets rows wrap across lines
+	// the tiles have to fill width by height exactly, or the row and column maths would work on a different grid than the tiles
+	if (tiles == 0 || tiles > INT_MAX || (headerWidth == 0 && ragged) || tiles % rowLength != 0
+		|| (headerHeight > 0 && (long long)headerHeight * rowLength != tiles)) { return; }
+
+	reserve((int)tiles, (int)counts[TILE_ENEMY], (int)counts[TILE_TERRAIN + TERRAIN_HIDDEN]);
+
+	memset(terrain, 0, ((size_t)tiles + 3) / 4);
+	memset(occupancy, OCCUPANT_NONE, (size_t)tiles);
+	for (const char* c = cursor; c < end; c++) {
+		unsigned char type = classes[(unsigned char)*c];
+		if (type == TILE_NONE) { continue; }
+		int code = (type < TILE_PLAYER) ? type - TILE_TERRAIN : TERRAIN_PLAIN; // characters and unknown symbols stand on plain terrain
+		if (code == TERRAIN_HIDDEN) { hiddenTiles[numHiddenTiles++] = numVertices; } // loads the array containing vertices of all hidden tiles
+		if (type == TILE_PLAYER || type == TILE_ENEMY) {
+			Characters& character = (type == TILE_PLAYER) ? user : enemies[numEnemies++];
+			character.vertex = numVertices;
+			character.seesUser = false;
+			character.counter = 0;
+			occupancy[numVertices] = (type == TILE_PLAYER) ? OCCUPANT_USER : OCCUPANT_ENEMY;
+		}
+		setTerrain(numVertices, code);
+		numVertices++;
+	}
+	width = (int)rowLength;
+	height = numVertices / width;
+	indexEnemies();
+}
+
+void Map::freeEdges() {
+	if (!edgesMapped) {
+		delete[] edgeOffsets;
+		delete[] edgeTargets;
+		delete[] edgeWeights;
+	}
+	edgeOffsets = nullptr;
+	edgeTargets = nullptr;
+	edgeWeights = nullptr;
+	numEdges = 0;
+	edgesMapped = false;
+	edgesVersion = -1;
+}
+
+void Map::freeTerrain() {
+	if (!terrainMapped) { delete[] terrain; }
+	terrain = nullptr;
+	terrainMapped = false;
+	terrainShared = false;
+}
+
+void Map::closeCompiled() { // drops everything that points into the compiled map before unmapping it
+	freeEdges();
+	if (terrainMapped) { freeTerrain(); }
+	if (landmarksMapped) { freeLandmarks(); }
+	compiled.close();
+}
+
+void Map::mapToGraph() { // converts map array into a graph stored in compressed sparse row form
+	maxWeight = 0;
+	minWeight = INT_MAX;
+	for (int u = 0; u < numVertices; u++) {
+		int weight = weightAt(u);
+		if (weight > maxWeight) { maxWeight = weight; }
+		if (weight != 0 && weight < minWeight) { minWeight = weight; }
+	}
+	if (minWeight == INT_MAX) { minWeight = 0; }
+	if (componentVersion != mapVersion) { buildComponents(); } // both graph types, see mayReach
+	if (graphType == CSR_GRAPH && edgeOffsets && edgesVersion == mapVersion) { return; } // already built, or loaded from a compiled map
+	freeEdges();
+	if (graphType == IMPLICIT_GRID) { return; } // edges are computed from the terrain during search instead
+	edgeOffsets = new int[numVertices + 1];
+	// first pass counts the edges of each tile so every array can be allocated exactly once
+	for (int pass = 0; pass < 2; pass++) {
+		numEdges = 0;
+		for (int u = 0; u < numVertices; u++) { // iterates through all tiles in map and checks if there is a tile you can move to from there
+			edgeOffsets[u] = numEdges;
+			if (!HasRule(EDGE_TERRAIN, terrainCode(u))) { continue; }
+			for (int direction = 0; direction < 4; direction++) {
+				int v = neighbour(u, direction);
+				if (v >= 0 && HasRule(EDGE_TERRAIN, terrainCode(v))) {
+					if (pass == 1) {
+						edgeTargets[numEdges] = v;
+						edgeWeights[numEdges] = (unsigned char)weightAt(v);
+					}
+					numEdges++;
+				}
+			}
+		}
+		edgeOffsets[numVertices] = numEdges;
+		if (pass == 0) {
+			edgeTargets = new int[numEdges];
+			edgeWeights = new unsigned char[numEdges];
+		}
+	}
+	edgesVersion = mapVersion;
+}
+// labels the pieces of the map enemies can walk between, so a chase after a target in another piece fails without a search
+void Map::buildComponents() {
+	freeComponents();
+	component = new int[numVertices];
+	componentQueue = new int[numVertices];
+	componentsSize = 16;
+	componentTiles = new int[componentsSize];
+	componentBoxes = new ComponentBox[componentsSize];
+	for (int v = 0; v < numVertices; v++) { component[v] = enemyPassable(v) ? -2 : -1; } // -2 until the tile is labelled
+	for (int v = 0; v < numVertices; v++) {
+		if (component[v] == -2) { labelComponent(v, -2, newComponent()); }
+	}
+	componentVersion = mapVersion;
+}
+
+void Map::freeComponents() {
+	if (!componentsShared) {
+		delete[] component;
+		delete[] componentTiles;
+		delete[] componentBoxes;
+		delete[] componentQueue;
+	}
+	component = nullptr;
+	componentTiles = nullptr;
+	componentBoxes = nullptr;
+	componentQueue = nullptr;
+	numComponents = 0;
+	componentsSize = 0;
+	liveComponents = 0;
+	componentVersion = -1;
+	componentsShared = false;
+}
+// hands out an empty component, labels are never reused so the arrays only grow
+int Map::newComponent() {
+	if (numComponents == componentsSize) {
+		int* tiles = new int[2 * componentsSize];
+		ComponentBox* boxes = new ComponentBox[2 * componentsSize];
+		memcpy(tiles, componentTiles, sizeof(int) * componentsSize);
+		memcpy(boxes, componentBoxes, sizeof(ComponentBox) * componentsSize);
+		delete[] componentTiles;
+		delete[] componentBoxes;
+		componentTiles = tiles;
+		componentBoxes = boxes;
+		componentsSize *= 2;
+	}
+	componentTiles[numComponents] = 0;
+	componentBoxes[numComponents] = { INT_MAX, INT_MAX, -1, -1 };
+	liveComponents++;
+	return numComponents++;
+}
+
+void Map::growComponentBox(int c, int vertex) {
+	ComponentBox& box = componentBoxes[c];
+	int x = vertex % width, y = vertex / width;
+	if (x < box.left) { box.left = x; }
+	if (x > box.right) { box.right = x; }
+	if (y < box.top) { box.top = y; }
+	if (y > box.bottom) { box.bottom = y; }
+}
+// moves start and every tile labelled from that it can reach through tiles labelled from into component label
+void Map::labelComponent(int start, int from, int label) {
+	int head = 0, tail = 0;
+	componentQueue[tail++] = start;
+	component[start] = label;
+	while (head < tail) {
+		int u = componentQueue[head++];
+		growComponentBox(label, u);
+		for (int direction = 0; direction < 4; direction++) {
+			int v = neighbour(u, direction);
+			if (v >= 0 && component[v] == from) {
+				component[v] = label;
+				componentQueue[tail++] = v;
+			}
+		}
+	}
+	componentTiles[label] += tail;
+}
+// a tile enemies can now stand on joins the components around it, the smaller ones are relabelled into the largest
+void Map::openComponentTile(int vertex) {
+	int keep = -1;
+	for (int direction = 0; direction < 4; direction++) {
+		int v = neighbour(vertex, direction);
+		if (v >= 0 && component[v] >= 0 && (keep < 0 || componentTiles[component[v]] > componentTiles[keep])) { keep = component[v]; }
+	}
+	if (keep < 0) { keep = newComponent(); }
+	for (int direction = 0; direction < 4; direction++) {
+		int v = neighbour(vertex, direction);
+		if (v >= 0 && component[v] >= 0 && component[v] != keep) {
+			int merged = component[v];
+			componentTiles[merged] = 0;
+			liveComponents--;
+			labelComponent(v, merged, keep);
+		}
+	}
+	component[vertex] = keep;
+	componentTiles[keep]++;
+	growComponentBox(keep, vertex);
+}
+// a tile enemies can no longer stand on only splits its component if the tiles around it are not joined some other way.
+// The cheap case keeps the old box, the split relabels each piece with a new label
+void Map::closeComponentTile(int vertex) {
+	int label = component[vertex];
+	component[vertex] = -1;
+	if (--componentTiles[label] == 0) {
+		liveComponents--;
+		return;
+	}
+	if (ringConnected(vertex)) { return; }
+	componentTiles[label] = 0;
+	liveComponents--;
+	for (int direction = 0; direction < 4; direction++) {
+		int v = neighbour(vertex, direction);
+		if (v >= 0 && component[v] == label) { labelComponent(v, label, newComponent()); }
+	}
+}
+// true if the open tiles beside vertex are joined through the 8 tiles around it, then closing vertex cannot split them
+bool Map::ringConnected(int vertex) {
+	int ring[8]; // clockwise from the tile above
+	ring[0] = neighbour(vertex, 0);
+	ring[2] = neighbour(vertex, 3);
+	ring[4] = neighbour(vertex, 1);
+	ring[6] = neighbour(vertex, 2);
+	ring[1] = (ring[0] >= 0) ? neighbour(ring[0], 3) : -1;
+	ring[3] = (ring[4] >= 0) ? neighbour(ring[4], 3) : -1;
+	ring[5] = (ring[4] >= 0) ? neighbour(ring[4], 2) : -1;
+	ring[7] = (ring[0] >= 0) ? neighbour(ring[0], 2) : -1;
+	bool open[8];
+	int start = -1;
+	for (int i = 0; i < 8; i++) {
+		open[i] = ring[i] >= 0 && component[ring[i]] >= 0;
+		if (!open[i]) { start = i; }
+	}
+	if (start < 0) { return true; }
+	int runs = 0; // runs of open tiles around the ring that hold a tile beside vertex
+	bool counted = false;
+	for (int i = 1; i <= 8; i++) {
+		int r = (start + i) % 8;
+		if (!open[r]) { counted = false; }
+		else if (r % 2 == 0 && !counted) {
+			runs++;
+			counted = true;
+		}
+	}
+	return runs <= 1;
+}
+// false only if no path leads from source to target, a source enemies cannot stand on is given the benefit of the doubt.
+// A target enemies cannot stand on, like the user on a hidden tile, is reached from its neighbours
+bool Map::mayReach(int source, int target) {
+	if (componentVersion != mapVersion || source == target) { return true; }
+	int c = component[source];
+	if (c < 0 || component[target] == c) { return true; }
+	if (component[target] >= 0) { return false; }
+	for (int direction = 0; direction < 4; direction++) {
+		int v = neighbour(target, direction);
+		if (v >= 0 && component[v] == c) { return true; }
+	}
+	return false;
+}
+// loads a map written by saveCompiled. The packed terrain and any stored adjacency are used in place from a copy on write
+// mapping instead of being copied or rebuilt. Returns false and leaves the map empty if the file is not a compiled map of
+// this version.
+bool Map::loadCompiled(string filename) {
+	if (!compiled.open(filename, true)) { return false; }
+	const char* data = compiled.data;
+	long long size = (long long)compiled.size;
+	MapFileHeader header;
+	bool valid = size >= (long long)sizeof(header);
+	if (valid) {
+		memcpy(&header, data, sizeof(header));
+		valid = memcmp(header.magic, MAP_FORMAT_MAGIC, 4) == 0 && header.version == MAP_FORMAT_VERSION && header.numVertices > 0
+			&& header.width > 0 && header.height > 0 && (long long)header.width * header.height == header.numVertices
+			&& header.player >= 0 && header.player < header.numVertices && header.numEnemies >= 0 && header.numHiddenTiles >= 0
+			&& header.numEdges >= 0 && header.numSections >= 0
+			&& (long long)sizeof(header) + (long long)header.numSections * (long long)sizeof(MapSection) <= size;
+	}
+	const char* sections[NUM_SECTION_TYPES] = { nullptr };
+	long long sectionSizes[NUM_SECTION_TYPES] = { 0 };
+	for (int i = 0; valid && i < header.numSections; i++) {
+		MapSection section;
+		memcpy(&section, data + sizeof(header) + i * sizeof(MapSection), sizeof(section));
+		if (section.offset < 0 || section.size < 0 || section.offset % 8 != 0 || section.offset + section.size > size) { valid = false; }
+		else if (section.type >= 0 && section.type < NUM_SECTION_TYPES) {
+			sections[section.type] = data + section.offset;
+			sectionSizes[section.type] = section.size;
+		}
+	}
+	long long n = valid ? header.numVertices : 0;
+	valid = valid && sectionSizes[SECTION_TILES] >= (n + 3) / 4 && sectionSizes[SECTION_ENEMIES] == 4LL * header.numEnemies
+		&& sectionSizes[SECTION_HIDDEN] == 4LL * header.numHiddenTiles;
+	if (valid && header.numEdges > 0) {
+		valid = sectionSizes[SECTION_EDGE_OFFSETS] == 4 * (n + 1) && sectionSizes[SECTION_EDGE_TARGETS] == 4LL * header.numEdges
+			&& sectionSizes[SECTION_EDGE_WEIGHTS] == header.numEdges;
+		const int* offsets = (const int*)sections[SECTION_EDGE_OFFSETS];
+		const int* targets = (const int*)sections[SECTION_EDGE_TARGETS];
+		valid = valid && offsets[0] == 0 && offsets[n] == header.numEdges;
+		for (long long u = 0; valid && u < n; u++) { valid = offsets[u] <= offsets[u + 1]; } // searches read every span as given
+		for (long long i = 0; valid && i < header.numEdges; i++) { valid = targets[i] >= 0 && targets[i] < n; }
+	}
+	long long landmarkCount = sectionSizes[SECTION_LANDMARKS] / 4; // optional, ignored if it does not fit the map
+	bool withLandmarks = valid && landmarkCount > 0 && landmarkCount <= MAX_LANDMARKS && sectionSizes[SECTION_LANDMARKS] == 4 * landmarkCount
+		&& sectionSizes[SECTION_LANDMARK_DIST] == 4 * landmarkCount * n;
+	for (long long i = 0; withLandmarks && i < landmarkCount; i++) {
+		int tile = ((const int*)sections[SECTION_LANDMARKS])[i];
+		withLandmarks = tile >= 0 && tile < n;
+	}
+	const unsigned char* tiles = (const unsigned char*)sections[SECTION_TILES];
+	const int* enemyTiles = (const int*)sections[SECTION_ENEMIES];
+	const int* hidden = (const int*)sections[SECTION_HIDDEN];
+	valid = valid && Enters<PlayerRules>(TerrainAt(tiles, header.player));
+	for (int i = 0; valid && i < header.numEnemies; i++) { valid = enemyTiles[i] >= 0 && enemyTiles[i] < n && Enters<EnemyRules>(TerrainAt(tiles, enemyTiles[i])); }
+	for (int i = 0; valid && i < header.numHiddenTiles; i++) { valid = hidden[i] >= 0 && hidden[i] < n && TerrainAt(tiles, hidden[i]) == TERRAIN_HIDDEN; }
+	if (valid) { // occupancy is written without looking, so no two characters may share a tile
+		int* taken = new int[header.numEnemies + 1];
+		memcpy(taken, enemyTiles, sizeof(int) * header.numEnemies);
+		taken[header.numEnemies] = header.player;
+		sort(taken, taken + header.numEnemies + 1);
+		for (int i = 1; valid && i <= header.numEnemies; i++) { valid = taken[i] != taken[i - 1]; }
+		delete[] taken;
+	}
+	if (!valid) {
+		compiled.close();
+		return false;
+	}
+
+	reserve(header.numVertices, header.numEnemies, header.numHiddenTiles);
+	freeTerrain();
+	terrain = (unsigned char*)sections[SECTION_TILES]; // setTile writes to private copies of the pages, never to the file
+	terrainMapped = true;
+	memset(occupancy, OCCUPANT_NONE, header.numVertices);
+	for (int i = 0; i <= header.numEnemies; i++) { // enemies, then the user
+		bool isUser = (i == header.numEnemies);
+		Characters& character = isUser ? user : enemies[i];
+		character.vertex = isUser ? header.player : enemyTiles[i];
+		character.seesUser = false;
+		character.counter = 0;
+		occupancy[character.vertex] = isUser ? OCCUPANT_USER : OCCUPANT_ENEMY;
+	}
+	if (header.numHiddenTiles > 0) { memcpy(hiddenTiles, hidden, sizeof(int) * header.numHiddenTiles); }
+	numVertices = header.numVertices;
+	numEnemies = header.numEnemies;
+	numHiddenTiles = header.numHiddenTiles;
+	width = header.width;
+	height = header.height;
+	indexEnemies();
+	if (header.numEdges > 0) { // nothing writes to the edge arrays, a change to the map builds new ones
+		edgeOffsets = (int*)sections[SECTION_EDGE_OFFSETS];
+		edgeTargets = (int*)sections[SECTION_EDGE_TARGETS];
+		edgeWeights = (unsigned char*)sections[SECTION_EDGE_WEIGHTS];
+		numEdges = header.numEdges;
+		edgesMapped = true;
+		edgesVersion = mapVersion;
+	}
+	if (withLandmarks) {
+		freeLandmarks();
+		landmarks = (int*)sections[SECTION_LANDMARKS];
+		landmarkDist = (int*)sections[SECTION_LANDMARK_DIST];
+		numLandmarks = (int)landmarkCount;
+		landmarksMapped = true;
+		landmarkVersion = mapVersion;
+	}
+	return true;
+}
+// writes the map in the format read by loadCompiled, with the adjacency if mapToGraph has built it for CSR_GRAPH and the
+// landmark distances if buildLandmarks has been run
+bool Map::saveCompiled(string filename) {
+	if (numVertices == 0) { return false; }
+	bool withEdges = graphType == CSR_GRAPH && edgeOffsets && edgesVersion == mapVersion;
+	bool withLandmarks = numLandmarks > 0 && landmarkVersion == mapVersion;
+	int* enemyTiles = new int[numEnemies + 1];
+	for (int i = 0; i < numEnemies; i++) { enemyTiles[i] = enemies[i].vertex; }
+
+	MapFileHeader header;
+	memcpy(header.magic, MAP_FORMAT_MAGIC, 4);
+	header.version = MAP_FORMAT_VERSION;
+	header.width = width;
+	header.height = height;
+	header.numVertices = numVertices;
+	header.player = user.vertex;
+	header.numEnemies = numEnemies;
+	header.numHiddenTiles = numHiddenTiles;
+	header.numEdges = withEdges ? numEdges : 0;
+	const char* contents[NUM_SECTION_TYPES] = { (const char*)terrain, (const char*)enemyTiles, (const char*)hiddenTiles,
+		(const char*)edgeOffsets, (const char*)edgeTargets, (const char*)edgeWeights, (const char*)landmarks, (const char*)landmarkDist };
+	long long sizes[NUM_SECTION_TYPES] = { (numVertices + 3) / 4, 4LL * numEnemies, 4LL * numHiddenTiles, 4LL * (numVertices + 1),
+		4LL * numEdges, numEdges, 4LL * numLandmarks, getLandmarkBytes() };
+	MapSection table[NUM_SECTION_TYPES];
+	header.numSections = 0;
+	for (int type = 0; type < NUM_SECTION_TYPES; type++) {
+		bool edgeSection = (type >= SECTION_EDGE_OFFSETS && type <= SECTION_EDGE_WEIGHTS);
+		bool landmarkSection = (type == SECTION_LANDMARKS || type == SECTION_LANDMARK_DIST);
+		if ((edgeSection && !withEdges) || (landmarkSection && !withLandmarks)) { continue; }
+		table[header.numSections].type = type;
+		table[header.numSections].reserved = 0;
+		table[header.numSections].size = sizes[type];
+		header.numSections++;
+	}
+	long long offset = sizeof(header) + header.numSections * sizeof(MapSection);
+	for (int i = 0; i < header.numSections; i++) {
+		offset = (offset + 7) / 8 * 8;
+		table[i].offset = offset;
+		offset += table[i].size;
+	}
+
+	ofstream outFS(filename, ios::binary);
+	outFS.write((const char*)&header, sizeof(header));
+	outFS.write((const char*)table, header.numSections * sizeof(MapSection));
+	long long written = sizeof(header) + header.numSections * sizeof(MapSection);
+	const char padding[8] = { 0 };
+	for (int i = 0; i < header.numSections; i++) {
+		outFS.write(padding, table[i].offset - written);
+		outFS.write(contents[table[i].type], table[i].size);
+		written = table[i].offset + table[i].size;
+	}
+	delete[] enemyTiles;
+	return outFS.good();
+}
+
+void Map::printMap() { // prints map
+	int counter = 0;
+	cout << "\t";
+	for (int i = 0; i < numVertices; i++) {
+		char symbol = symbolAt(i);
+		SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), SymbolColor(symbol)); // sets colors based on type of tile
+		cout << symbol << " ";
+		counter++;
+		if (counter == width) { // displays map array as 2d array by inserting a newline after a row is completed
+			cout << "\n\t";
+			counter = 0;
+		}
+		SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 15); // resets text color to white
+	}
+}
+
+// modified Dijkstra's algorithm that finds the path from a source to a target and returns the first step along it
+int Map::Dijkstra(SearchContext& context, int source, int target) {
+	if (queueType == DENSE_ARRAY || (queueType == AUTO_QUEUE && numVertices <= DENSE_MAX_VERTICES)) { return denseSearch<EnemyRules>(context, source, target); }
+	if (graphType == CSR_GRAPH) { return Dijkstra(context, csrView(), source, target); }
+	return Dijkstra(context, gridView(), source, target);
+}
+
+template <class Graph> int Map::Dijkstra(SearchContext& context, const Graph& graph, int source, int target) {
+	if (queueType == BINARY_HEAP) {
+		context.heap.clear();
+		return search<EnemyRules>(context, context.heap, graph, source, target);
+	}
+	context.buckets.widen(maxWeight);
+	return search<EnemyRules>(context, context.buckets, graph, source, target);
+}
+// settles vertices in order of distance using the given frontier and stops as soon as the target is settled, only passing
+// through tiles Rules lets the searching character onto
+template <class Rules, class Queue, class Graph> int Map::search(SearchContext& context, Queue& frontier, const Graph& graph, int source, int target) {
+	context.begin(numVertices);
+	context.reach(source, 0, -1);
+	frontier.push(source, 0);
+	int count = 0;
+	PROBE(int relaxed = 0, queueOps = 1;)
+
+	while (!frontier.empty()) {
+		int u = frontier.pop();
+		PROBE(queueOps++;)
+		if (context.isSettled(u)) { continue; } // stale entry left behind by a later improvement
+		context.settle(u);
+		count++;
+		if (u == target) { break; }
+		EdgeBuffer buffer;
+		EdgeSpan span = graph.edges(u, buffer);
+		for (int i = 0; i < span.count; i++) { // only relaxes actual neighbours of u
+			int v = span.targets[i];
+			int alt = context.dist[u] + span.weights[i];
+			if (!context.isSettled(v) && (!context.reached(v) || alt < context.dist[v]) && (Enters<Rules>(terrainCode(v)) || v == target)) {
+				context.reach(v, alt, u);
+				frontier.push(v, alt);
+				PROBE(relaxed++; queueOps++;)
+			}
+		}
+	}
+
+	settled = count;
+	PROBE(if (stats) { stats->recordSearch(count, relaxed, queueOps); })
+	return context.isSettled(target) ? firstStep(context.pi, source, target) : source; // stays in place if the target cannot be reached
+}
+
+// Dijkstra's without a queue: the frontier is the array of keys and DensePop takes the smallest one out. Only groups
+// between low and high can hold a key, and they are set back to INT_MAX at the end. Neighbours come straight from the
+// grid, which has the same edges as the CSR graph, and RelaxMask compares all four at once.
+template <class Rules> int Map::denseSearch(SearchContext& context, int source, int target) {
+	context.begin(numVertices);
+	context.reserveDense(numVertices);
+	int* key = context.denseKey;
+	int* blockMin = context.denseBlockMin;
+	int* groupMin = context.denseGroupMin;
+	context.reach(source, 0, -1);
+	key[source] = 0;
+	blockMin[source >> 3] = 0;
+	groupMin[source >> 6] = 0;
+	int low = source >> 6, high = low; // groups that may hold a key
+	int count = 0;
+	PROBE(int relaxed = 0, queueOps = 1;)
+
+	while (true) {
+		int u = DensePop(key, blockMin, groupMin, low & ~7, (high + 8) & ~7); // groupMin is padded to whole vectors
+		if (u < 0) { break; }
+		PROBE(queueOps++;)
+		context.settle(u);
+		count++;
+		if (u == target) { break; }
+
+		int column = u % width;
+		int next[4] = { u - width, u + width, column > 0 ? u - 1 : -1, column < width - 1 ? u + 1 : -1 };
+		int alt[4], current[4];
+		for (int i = 0; i < 4; i++) {
+			int v = next[i];
+			current[i] = INT_MIN; // never improved
+			alt[i] = 0;
+			if (v < 0 || v >= numVertices || context.isSettled(v)) { continue; }
+			int code = terrainCode(v);
+			if (TERRAIN_WEIGHTS[code] == 0 || (!Enters<Rules>(code) && v != target)) { continue; }
+			current[i] = context.reached(v) ? context.dist[v] : INT_MAX;
+			alt[i] = context.dist[u] + TERRAIN_WEIGHTS[code];
+		}
+		for (int mask = RelaxMask(alt, current); mask; mask &= mask - 1) {
+			int i = FirstBit(mask), v = next[i];
+			context.reach(v, alt[i], u);
+			key[v] = alt[i];
+			if (alt[i] < blockMin[v >> 3]) { blockMin[v >> 3] = alt[i]; }
+			if (alt[i] < groupMin[v >> 6]) { groupMin[v >> 6] = alt[i]; }
+			if ((v >> 6) < low) { low = v >> 6; }
+			if ((v >> 6) > high) { high = v >> 6; }
+			PROBE(relaxed++; queueOps++;)
+		}
+	}
+	for (int g = low; g <= high; g++) {
+		for (int i = g * 64; i < g * 64 + 64; i++) { key[i] = INT_MAX; }
+		for (int i = g * 8; i < g * 8 + 8; i++) { blockMin[i] = INT_MAX; }
+		groupMin[g] = INT_MAX;
+	}
+
+	settled = count;
+	PROBE(if (stats) { stats->recordSearch(count, relaxed, queueOps); })
+	return context.isSettled(target) ? firstStep(context.pi, source, target) : source;
+}
+
+int Map::firstStep(int* pi, int source, int target) {
+	int next = target;
+	if (next == source) { return source; }
+	while (pi[next] != source) { next = pi[next]; } // backtracks through each predecessor until the next step is calculated
+	return next;
+}
+// Manhattan distance scaled by the cheapest terrain, a lower bound on the cost of any path from u to target
+int Map::heuristic(int u, int target) {
+	int dx = u % width - target % width;
+	int dy = u / width - target / width;
+	return (abs(dx) + abs(dy)) * minWeight;
+}
+// heuristic used by A*, in CHASE_LANDMARKS the best triangle inequality bound from the landmark distances as well. Moving
+// onto a tile costs its weight, so the distance from v back to a landmark is the distance from the landmark to v minus
+// the weight of v plus the weight of the landmark, and one table per landmark gives bounds in both directions.
+int Map::lowerBound(int u, int target) {
+	int best = heuristic(u, target);
+	if (chaseMode != CHASE_LANDMARKS || landmarkVersion != mapVersion) { return best; }
+	const int* fromU = landmarkDist + (long long)u * numLandmarks;
+	const int* fromTarget = landmarkDist + (long long)target * numLandmarks;
+	int weightU = weightAt(u), weightTarget = weightAt(target);
+	for (int i = 0; i < numLandmarks; i++) {
+		if (fromU[i] == INT_MAX || fromTarget[i] == INT_MAX) { continue; } // landmark is in another part of the map
+		int forward = fromTarget[i] - fromU[i]; // d(L, target) - d(L, u) <= d(u, target)
+		int backward = (fromU[i] - weightU) - (fromTarget[i] - weightTarget); // d(u, L) - d(target, L) <= d(u, target)
+		if (forward > best) { best = forward; }
+		if (backward > best) { best = backward; }
+	}
+	return best;
+}
+// A* search from source to target, returns the same next step as Dijkstra's but settles far fewer vertices
+int Map::AStar(SearchContext& context, int source, int target) {
+	if (graphType == CSR_GRAPH) { return AStar(context, csrView(), source, target); }
+	return AStar(context, gridView(), source, target);
+}
+
+template <class Graph> int Map::AStar(SearchContext& context, const Graph& graph, int source, int target) {
+	if (queueType == BINARY_HEAP) {
+		context.heap.clear();
+		return aStarSearch<EnemyRules>(context, context.heap, graph, source, target);
+	}
+	// with a consistent heuristic, queued keys never span more than maxWeight plus the most the bound can drop over one edge
+	context.buckets.widen(maxWeight + ((chaseMode == CHASE_LANDMARKS) ? maxWeight : minWeight));
+	return aStarSearch<EnemyRules>(context, context.buckets, graph, source, target);
+}
+
+template <class Rules, class Queue, class Graph> int Map::aStarSearch(SearchContext& context, Queue& frontier, const Graph& graph, int source, int target) {
+	context.begin(numVertices);
+	context.reach(source, 0, -1);
+	frontier.push(source, lowerBound(source, target));
+	int count = 0;
+	PROBE(int relaxed = 0, queueOps = 1;)
+
+	while (!frontier.empty()) {
+		int u = frontier.pop();
+		PROBE(queueOps++;)
+		if (context.isSettled(u)) { continue; }
+		context.settle(u); // the heuristic is consistent, so a settled vertex never needs to be reopened
+		count++;
+		if (u == target) { break; }
+		EdgeBuffer buffer;
+		EdgeSpan span = graph.edges(u, buffer);
+		for (int i = 0; i < span.count; i++) {
+			int v = span.targets[i];
+			int alt = context.dist[u] + span.weights[i];
+			if (!context.isSettled(v) && (!context.reached(v) || alt < context.dist[v]) && (Enters<Rules>(terrainCode(v)) || v == target)) {
+				context.reach(v, alt, u);
+				frontier.push(v, alt + lowerBound(v, target));
+				PROBE(relaxed++; queueOps++;)
+			}
+		}
+	}
+
+	settled = count;
+	PROBE(if (stats) { stats->recordSearch(count, relaxed, queueOps); })
+	return context.isSettled(target) ? firstStep(context.pi, source, target) : source;
+}
+// rebuilds the flow field only if the user has moved or the tiles were reloaded since it was last built
+void Map::updateFlowField(int target) {
+	if (flowTarget == target && flowVersion == mapVersion) { return; }
+	if (flowVersion != mapVersion) { // map may have changed size since the arrays were allocated
+		delete[] flowDist;
+		delete[] flowNext;
+		flowDist = new int[numVertices];
+		flowNext = new int[numVertices];
+	}
+	SearchContext& context = contexts[0]; // only built outside of the planning threads
+	context.heap.clear();
+	context.buckets.widen(maxWeight);
+	if (graphType == CSR_GRAPH) {
+		if (queueType == BINARY_HEAP) { buildFlowField<EnemyRules>(context, context.heap, csrView(), target); }
+		else { buildFlowField<EnemyRules>(context, context.buckets, csrView(), target); }
+	}
+	else {
+		if (queueType == BINARY_HEAP) { buildFlowField<EnemyRules>(context, context.heap, gridView(), target); }
+		else { buildFlowField<EnemyRules>(context, context.buckets, gridView(), target); }
+	}
+	flowTarget = target;
+	flowVersion = mapVersion;
+}
+// one reverse Dijkstra's from the target that gives every tile its distance to the target and its next step towards it
+template <class Rules, class Queue, class Graph> void Map::buildFlowField(SearchContext& context, Queue& frontier, const Graph& graph, int target) {
+	context.begin(numVertices);
+	for (int i = 0; i < numVertices; i++) {
+		flowDist[i] = INT_MAX;
+		flowNext[i] = -1;
+	}
+
+	flowDist[target] = 0;
+	frontier.push(target, 0);
+	PROBE(int count = 0, relaxed = 0, queueOps = 1;)
+
+	while (!frontier.empty()) {
+		int v = frontier.pop();
+		PROBE(queueOps++;)
+		if (context.isSettled(v)) { continue; }
+		context.settle(v);
+		PROBE(count++;)
+		if (!Enters<Rules>(terrainCode(v)) && v != target) { continue; } // no path passes through a tile the character cannot step onto
+		int cost = weightAt(v); // every edge into v costs the weight of v
+		EdgeBuffer buffer;
+		EdgeSpan span = graph.edges(v, buffer); // edges are symmetric on the grid, so v's neighbours are also its predecessors
+		for (int i = 0; i < span.count; i++) {
+			int u = span.targets[i];
+			int alt = flowDist[v] + cost;
+			if (!context.isSettled(u) && alt < flowDist[u]) {
+				flowDist[u] = alt;
+				flowNext[u] = v;
+				frontier.push(u, alt);
+				PROBE(relaxed++; queueOps++;)
+			}
+		}
+	}
+	PROBE(if (stats) { stats->recordSearch(count, relaxed, queueOps); })
+}
+// changes the terrain of a single tile, e.g. a wall being built, and repairs whatever search data depends on it
+void Map::setTile(int vertex, char symbol) {
+	int code = TerrainFromSymbol(symbol);
+	int old = terrainCode(vertex);
+	if (old == code) { return; }
+	if (terrainShared) { // the other sessions keep reading the original terrain
+		unsigned char* copy = new unsigned char[(mapSize + 3) / 4];
+		memcpy(copy, terrain, ((size_t)numVertices + 3) / 4);
+		freeTerrain();
+		terrain = copy;
+	}
+	if (sightShared) { freeSight(); } // both are updated in place below, so they are rebuilt for this map alone instead
+	if (hierarchyShared) { freeHierarchy(); }
+	if (componentsShared) { freeComponents(); }
+	setTerrain(vertex, code); // a character standing on the tile keeps being displayed, the new terrain shows once it moves off
+	if (TERRAIN_WEIGHTS[code] > maxWeight) { maxWeight = TERRAIN_WEIGHTS[code]; }
+	if (TERRAIN_WEIGHTS[code] != 0 && TERRAIN_WEIGHTS[code] < minWeight) { minWeight = TERRAIN_WEIGHTS[code]; }
+	if (old == TERRAIN_HIDDEN) { // keeps the respawn list in line with the hidden tiles
+		for (int i = 0; i < numHiddenTiles; i++) {
+			if (hiddenTiles[i] == vertex) { hiddenTiles[i] = hiddenTiles[--numHiddenTiles]; break; }
+		}
+	}
+	if (code == TERRAIN_HIDDEN) {
+		if (numHiddenTiles == hiddenSize) { expandHidden(); }
+		hiddenTiles[numHiddenTiles++] = vertex;
+	}
+	mapVersion++;
+	// distances can only have grown if the tile lost its edges or became more expensive, so the old ones are still lower bounds
+	if (landmarkVersion == mapVersion - 1 && (!HasRule(EDGE_TERRAIN, code) || (HasRule(EDGE_TERRAIN, old) && TERRAIN_WEIGHTS[code] >= TERRAIN_WEIGHTS[old]))) {
+		landmarkVersion = mapVersion;
+	}
+	// a tile that got dearer or closed only changes the paths through it, a cheaper or newly open one can shorten any path
+	bool dearer = !enemyPassable(vertex) || (Enters<EnemyRules>(old) && TERRAIN_WEIGHTS[code] >= TERRAIN_WEIGHTS[old]);
+	if (pathCacheVersion == mapVersion - 1 && dearer && !pathCache->onPath(vertex)) { pathCacheVersion = mapVersion; }
+	if (componentVersion == mapVersion - 1) { // before mapToGraph, which would relabel the whole map
+		if (enemyPassable(vertex) && !Enters<EnemyRules>(old)) { openComponentTile(vertex); }
+		else if (!enemyPassable(vertex) && Enters<EnemyRules>(old)) { closeComponentTile(vertex); }
+		componentVersion = mapVersion;
+	}
+	if (graphType == CSR_GRAPH) { mapToGraph(); } // edges into and out of the tile change
+	if (hierarchyVersion == mapVersion - 1) { updateHierarchy(vertex); }
+	if (sightVersion == mapVersion - 1) {
+		updateSight(vertex);
+		sightVersion = mapVersion;
+	}
+	for (int i = 0; i < numSearches; i++) { // the tile's cost changed, so it and every tile stepping onto it may be inconsistent now
+		if (searches[i].g && searches[i].version == mapVersion - 1) {
+			updateVertex(searches[i], vertex);
+			for (int direction = 0; direction < 4; direction++) {
+				int p = neighbour(vertex, direction);
+				if (p >= 0) { updateVertex(searches[i], p); }
+			}
+			searches[i].version = mapVersion;
+		}
+	}
+}
+// partitions the map into clusters and precomputes the abstract graph used by CHASE_HIERARCHICAL
+void Map::buildHierarchy(int size) {
+	freeHierarchy();
+	if (size < 4) { size = 4; }
+	if (size > MAX_CLUSTER_SIZE) { size = MAX_CLUSTER_SIZE; }
+	clusterSize = size;
+	clustersWide = (width + size - 1) / size;
+	clustersHigh = (height + size - 1) / size;
+	int numClusters = clustersWide * clustersHigh;
+	clusters = new Cluster[numClusters];
+	for (int c = 0; c < numClusters; c++) {
+		clusters[c].nodes = nullptr;
+		clusters[c].dist = nullptr;
+		clusters[c].numNodes = 0;
+	}
+	nodeSlot = new unsigned char[numVertices];
+	for (int c = 0; c < numClusters; c++) { buildCluster(c); }
+	hierarchyVersion = mapVersion;
+}
+
+void Map::freeHierarchy() {
+	if (clusters && !hierarchyShared) {
+		for (int c = 0; c < clustersWide * clustersHigh; c++) {
+			delete[] clusters[c].nodes;
+			delete[] clusters[c].dist;
+		}
+	}
+	if (!hierarchyShared) {
+		delete[] clusters;
+		delete[] nodeSlot;
+	}
+	clusters = nullptr;
+	nodeSlot = nullptr;
+	hierarchyVersion = -1;
+	hierarchyShared = false;
+}
+// finds the entrance tiles of a cluster and the shortest paths between them inside the cluster
+void Map::buildCluster(int c) {
+	int x0 = (c % clustersWide) * clusterSize, y0 = (c / clustersWide) * clusterSize;
+	int x1 = (x0 + clusterSize < width) ? x0 + clusterSize : width, y1 = (y0 + clusterSize < height) ? y0 + clusterSize : height;
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) { nodeSlot[y * width + x] = NO_SLOT; }
+	}
+	delete[] clusters[c].nodes;
+	delete[] clusters[c].dist;
+
+	int nodes[4 * MAX_CLUSTER_SIZE];
+	int numNodes = 0;
+	for (int side = 0; side < 4; side++) { addEntrances(c, side, nodes, numNodes); }
+	clusters[c].numNodes = numNodes;
+	clusters[c].nodes = new int[numNodes];
+	clusters[c].dist = new int[numNodes * numNodes];
+	for (int a = 0; a < numNodes; a++) { clusters[c].nodes[a] = nodes[a]; }
+
+	int dist[MAX_CLUSTER_TILES], pi[MAX_CLUSTER_TILES];
+	BinaryHeap frontier;
+	for (int a = 0; a < numNodes; a++) {
+		clusterSearch(c, nodes[a], false, dist, pi, frontier);
+		for (int b = 0; b < numNodes; b++) {
+			clusters[c].dist[a * numNodes + b] = dist[localIndex(c, nodes[b])];
+		}
+	}
+}
+// adds an entrance for every run of open tile pairs along one side of a cluster (0 top, 1 bottom, 2 left, 3 right).
+// The neighbouring cluster walks the same border in the same order, so both sides pick matching tiles.
+void Map::addEntrances(int c, int side, int* nodes, int& numNodes) {
+	int x0 = (c % clustersWide) * clusterSize, y0 = (c / clustersWide) * clusterSize;
+	int x1 = (x0 + clusterSize < width) ? x0 + clusterSize : width, y1 = (y0 + clusterSize < height) ? y0 + clusterSize : height;
+	if ((side == 0 && y0 == 0) || (side == 1 && y1 == height) || (side == 2 && x0 == 0) || (side == 3 && x1 == width)) { return; }
+	int length = (side < 2) ? x1 - x0 : y1 - y0;
+	int runStart = -1;
+	for (int i = 0; i <= length; i++) {
+		bool open = false;
+		if (i < length) {
+			int tile, across;
+			if (side == 0) { tile = y0 * width + x0 + i; across = tile - width; }
+			else if (side == 1) { tile = (y1 - 1) * width + x0 + i; across = tile + width; }
+			else if (side == 2) { tile = (y0 + i) * width + x0; across = tile - 1; }
+			else { tile = (y0 + i) * width + x1 - 1; across = tile + 1; }
+			open = enemyPassable(tile) && enemyPassable(across);
+		}
+		if (open && runStart < 0) { runStart = i; }
+		if (!open && runStart >= 0) { // run ended, long runs get an entrance at each end and short ones a single one in the middle
+			int picks[2] = { runStart + (i - 1 - runStart) / 2, -1 };
+			if (i - runStart >= 6) {
+				picks[0] = runStart;
+				picks[1] = i - 1;
+			}
+			for (int k = 0; k < 2 && picks[k] >= 0; k++) {
+				int tile = (side == 0) ? y0 * width + x0 + picks[k] : (side == 1) ? (y1 - 1) * width + x0 + picks[k]
+					: (side == 2) ? (y0 + picks[k]) * width + x0 : (y0 + picks[k]) * width + x1 - 1;
+				if (nodeSlot[tile] == NO_SLOT) { // corner tiles can be picked from two sides
+					nodeSlot[tile] = (unsigned char)numNodes;
+					nodes[numNodes++] = tile;
+				}
+			}
+			runStart = -1;
+		}
+	}
+}
+// Dijkstra's restricted to one cluster, dist is indexed by localIndex and pi holds map vertices.
+// A reverse search gives the distance from every tile of the cluster to from instead.
+void Map::clusterSearch(int c, int from, bool reverse, int* dist, int* pi, BinaryHeap& frontier) {
+	int x0 = (c % clustersWide) * clusterSize, y0 = (c / clustersWide) * clusterSize;
+	int x1 = (x0 + clusterSize < width) ? x0 + clusterSize : width, y1 = (y0 + clusterSize < height) ? y0 + clusterSize : height;
+	bool visited[MAX_CLUSTER_TILES];
+	for (int i = 0; i < clusterSize * clusterSize; i++) {
+		dist[i] = INT_MAX;
+		pi[i] = -1;
+		visited[i] = false;
+	}
+	frontier.clear();
+	dist[localIndex(c, from)] = 0;
+	frontier.push(from, 0);
+	while (!frontier.empty()) {
+		int u = frontier.pop();
+		int lu = localIndex(c, u);
+		if (visited[lu]) { continue; }
+		visited[lu] = true;
+		for (int direction = 0; direction < 4; direction++) {
+			int v = neighbour(u, direction);
+			if (v < 0 || v % width < x0 || v % width >= x1 || v / width < y0 || v / width >= y1 || !enemyPassable(v)) { continue; }
+			int lv = localIndex(c, v);
+			int alt = dist[lu] + weightAt(reverse ? u : v); // moving from v to u when reversed
+			if (!visited[lv] && alt < dist[lv]) {
+				dist[lv] = alt;
+				pi[lv] = u;
+				frontier.push(v, alt);
+			}
+		}
+	}
+}
+// recomputes the clusters whose entrances or internal paths depend on a tile that changed
+void Map::updateHierarchy(int vertex) {
+	int c = clusterOf(vertex);
+	int x = vertex % width, y = vertex / width;
+	int cx = c % clustersWide, cy = c / clustersWide;
+	buildCluster(c);
+	// entrances on a shared border are picked from both sides, so the cluster across the border is rebuilt too
+	if (y % clusterSize == 0 && cy > 0) { buildCluster(c - clustersWide); }
+	if ((y + 1) % clusterSize == 0 && cy < clustersHigh - 1) { buildCluster(c + clustersWide); }
+	if (x % clusterSize == 0 && cx > 0) { buildCluster(c - 1); }
+	if ((x + 1) % clusterSize == 0 && cx < clustersWide - 1) { buildCluster(c + 1); }
+	hierarchyVersion = mapVersion;
+}
+
+void Map::relaxAbstract(SearchContext& context, int id, int dist, int prev, int key, BinaryHeap& frontier) {
+	if (context.abstractSettled(id)) { return; }
+	if (!context.abstractReached(id) || dist < context.abstractDist[id]) {
+		context.abstractStamp[id] = context.abstractEpoch;
+		context.abstractDist[id] = dist;
+		context.abstractPrev[id] = prev;
+		frontier.push(id, key);
+		PROBE(context.abstractPushes++;)
+	}
+}
+// plans on the abstract graph of cluster entrances and only refines the first leg into actual tiles
+int Map::hierarchicalStep(int source, int target, SearchContext& context) {
+	if (hierarchyVersion != mapVersion) { buildHierarchy(clusterSize ? clusterSize : 10); }
+	int sourceCluster = clusterOf(source), targetCluster = clusterOf(target);
+	if (sourceCluster == targetCluster) { return AStar(context, source, target); } // close enough that a plain search is cheap
+	if (!enemyPassable(target)) { return AStar(context, source, target); } // the cluster search cannot start on a hidden tile
+
+	int sourceDist[MAX_CLUSTER_TILES], sourcePi[MAX_CLUSTER_TILES], targetDist[MAX_CLUSTER_TILES], targetPi[MAX_CLUSTER_TILES];
+	BinaryHeap& frontier = context.heap;
+	clusterSearch(sourceCluster, source, false, sourceDist, sourcePi, frontier);
+	clusterSearch(targetCluster, target, true, targetDist, targetPi, frontier);
+
+	int slots = 4 * clusterSize;
+	int goal = clustersWide * clustersHigh * slots;
+	context.beginAbstract(goal + 1);
+	PROBE(int count = 0, pops = 0;)
+	frontier.clear();
+	for (int k = 0; k < clusters[sourceCluster].numNodes; k++) { // source connects to the entrances it can reach inside its cluster
+		int node = clusters[sourceCluster].nodes[k];
+		int d = sourceDist[localIndex(sourceCluster, node)];
+		if (d != INT_MAX) { relaxAbstract(context, sourceCluster * slots + k, d, -1, d + heuristic(node, target), frontier); }
+	}
+	bool found = false;
+	while (!frontier.empty()) {
+		int id = frontier.pop();
+		PROBE(pops++;)
+		if (context.abstractSettled(id)) { continue; }
+		context.abstractStamp[id] = context.abstractEpoch + 1;
+		PROBE(count++;)
+		if (id == goal) {
+			found = true;
+			break;
+		}
+		int c = id / slots, k = id % slots;
+		Cluster& cluster = clusters[c];
+		int node = cluster.nodes[k], g = context.abstractDist[id];
+		if (c == targetCluster) { // entrances of the target's cluster connect to the target
+			int d = targetDist[localIndex(c, node)];
+			if (d != INT_MAX) { relaxAbstract(context, goal, g + d, id, g + d, frontier); }
+		}
+		for (int j = 0; j < cluster.numNodes; j++) { // paths through the cluster
+			int d = cluster.dist[k * cluster.numNodes + j];
+			if (j != k && d != INT_MAX) { relaxAbstract(context, c * slots + j, g + d, id, g + d + heuristic(cluster.nodes[j], target), frontier); }
+		}
+		for (int direction = 0; direction < 4; direction++) { // steps across the border into the next cluster
+			int v = neighbour(node, direction);
+			if (v >= 0 && nodeSlot[v] != NO_SLOT && clusterOf(v) != c && enemyPassable(v)) {
+				relaxAbstract(context, clusterOf(v) * slots + nodeSlot[v], g + weightAt(v), id, g + weightAt(v) + heuristic(v, target), frontier);
+			}
+		}
+	}
+	PROBE(if (stats) { stats->recordSearch(count, context.abstractPushes, context.abstractPushes + pops); })
+	if (!found) { return source; }
+
+	int first = context.abstractPrev[goal], second = -1; // backtracks to the first two entrances on the abstract path
+	while (context.abstractPrev[first] != -1) {
+		second = first;
+		first = context.abstractPrev[first];
+	}
+	int leg = clusters[first / slots].nodes[first % slots];
+	if (leg == source) {
+		leg = clusters[second / slots].nodes[second % slots];
+		if (clusterOf(leg) != sourceCluster) { return leg; } // source is an entrance and the path crosses the border right away
+	}
+	int next = leg;
+	while (sourcePi[localIndex(sourceCluster, next)] != source) { next = sourcePi[localIndex(sourceCluster, next)]; }
+	return next;
+}
+// picks landmarks by farthest point selection, each new landmark is the tile furthest from all the ones chosen so far,
+// and stores the distance from every landmark to every tile for the CHASE_LANDMARKS lower bounds. Distances are taken
+// with hidden tiles open, which only makes them smaller, so they stay lower bounds for enemies that cannot enter them.
+void Map::buildLandmarks(int count) {
+	freeLandmarks();
+	if (count > MAX_LANDMARKS) { count = MAX_LANDMARKS; }
+	if (count < 1 || numVertices == 0) { return; }
+	landmarks = new int[count];
+	landmarkDist = new int[(long long)count * numVertices];
+	int* dist = new int[numVertices];
+	int* nearest = new int[numVertices]; // distance from the closest landmark so far
+	BucketQueue frontier(maxWeight);
+	int start = 0;
+	while (start < numVertices - 1 && !HasRule(EDGE_TERRAIN, terrainCode(start))) { start++; }
+	landmarkSearch(start, nearest, frontier);
+	while (numLandmarks < count) {
+		int farthest = -1;
+		for (int v = 0; v < numVertices; v++) {
+			if (HasRule(EDGE_TERRAIN, terrainCode(v)) && nearest[v] > 0 && (farthest < 0 || nearest[v] > nearest[farthest])) { farthest = v; }
+		}
+		if (farthest < 0) { break; } // every open tile is already a landmark
+		landmarkSearch(farthest, dist, frontier);
+		for (int v = 0; v < numVertices; v++) {
+			landmarkDist[(long long)v * count + numLandmarks] = dist[v];
+			if (numLandmarks == 0 || dist[v] < nearest[v]) { nearest[v] = dist[v]; }
+		}
+		landmarks[numLandmarks++] = farthest;
+	}
+	if (numLandmarks < count) { // packs the rows so they are numLandmarks wide
+		for (long long v = 0; v < numVertices; v++) {
+			for (int i = 0; i < numLandmarks; i++) { landmarkDist[v * numLandmarks + i] = landmarkDist[v * count + i]; }
+		}
+	}
+	landmarkVersion = mapVersion;
+	delete[] dist;
+	delete[] nearest;
+}
+
+void Map::freeLandmarks() {
+	if (!landmarksMapped) {
+		delete[] landmarks;
+		delete[] landmarkDist;
+	}
+	landmarks = nullptr;
+	landmarkDist = nullptr;
+	numLandmarks = 0;
+	landmarksMapped = false;
+	landmarkVersion = -1;
+}
+// distance from source to every tile, moving onto a tile costs its weight and only tiles without edges are closed
+void Map::landmarkSearch(int source, int* dist, BucketQueue& frontier) {
+	for (int i = 0; i < numVertices; i++) { dist[i] = INT_MAX; }
+	frontier.clear();
+	dist[source] = 0;
+	frontier.push(source, 0);
+	while (!frontier.empty()) {
+		int u = frontier.pop();
+		for (int direction = 0; direction < 4; direction++) {
+			int v = neighbour(u, direction);
+			if (v < 0 || !HasRule(EDGE_TERRAIN, terrainCode(v))) { continue; }
+			int alt = dist[u] + weightAt(v);
+			if (alt < dist[v]) {
+				dist[v] = alt;
+				frontier.push(v, alt);
+			}
+		}
+	}
+}
+
+// contraction hierarchy over the tiles enemies can stand on. Moving onto a tile costs its weight, which makes the graph
+// directed, but a path from s to t costs the same as half the sum of (w(u) + w(v)) over its edges plus (w(t) - w(s)) / 2,
+// and that last part is the same for every path between s and t. So the hierarchy is built on the undirected graph
+// with edge weights w(u) + w(v), and one set of upward edges serves both halves of a query. Hidden tiles are left out
+// entirely since enemies cannot pass through them, a query for a hidden target starts its backward half from the
+// target's neighbours. Tiles are contracted in order of edge difference, the shortcuts a tile needs minus the edges
+// it removes, plus the number of its neighbours already contracted so the order spreads over the map.
+void Map::buildContraction() {
+	freeContraction();
+	if (numVertices == 0) { return; }
+	contractionRank = new int[numVertices];
+	ContractionList* lists = new ContractionList[numVertices];
+	int* contractedNeighbours = new int[numVertices];
+	for (int v = 0; v < numVertices; v++) {
+		contractionRank[v] = -1;
+		contractedNeighbours[v] = 0;
+		lists[v].edges = nullptr;
+		lists[v].count = 0;
+		lists[v].capacity = 0;
+		if (!enemyPassable(v)) { continue; }
+		lists[v].capacity = 4;
+		lists[v].edges = new ContractionEdge[4];
+		for (int direction = 0; direction < 4; direction++) {
+			int u = neighbour(v, direction);
+			if (u >= 0 && enemyPassable(u)) {
+				ContractionEdge& edge = lists[v].edges[lists[v].count++];
+				edge.target = u;
+				edge.weight = weightAt(u) + weightAt(v);
+				edge.middle = -1;
+			}
+		}
+	}
+	SearchContext& context = contexts[0];
+	BinaryHeap order;
+	for (int v = 0; v < numVertices; v++) {
+		if (enemyPassable(v)) { order.push(v, contractTile(lists, v, false, context) - lists[v].count); }
+	}
+	int rank = 0;
+	while (!order.empty()) {
+		int v = order.pop();
+		if (contractionRank[v] >= 0) { continue; }
+		// shortcuts added elsewhere can still change a priority, so it is checked again when the tile comes up
+		int priority = contractTile(lists, v, false, context) - lists[v].count + contractedNeighbours[v];
+		if (!order.empty() && priority > order.minKey()) {
+			order.push(v, priority);
+			continue;
+		}
+		numShortcuts += contractTile(lists, v, true, context);
+		contractionRank[v] = rank++;
+		for (int i = 0; i < lists[v].count; i++) { // what is left in v's list are its upward edges
+			int u = lists[v].edges[i].target;
+			ContractionList& other = lists[u];
+			for (int j = 0; j < other.count; j++) {
+				if (other.edges[j].target == v) {
+					other.edges[j] = other.edges[--other.count];
+					break;
+				}
+			}
+			contractedNeighbours[u]++;
+		}
+	}
+
+	upOffsets = new int[numVertices + 1];
+	upOffsets[0] = 0;
+	for (int v = 0; v < numVertices; v++) { upOffsets[v + 1] = upOffsets[v] + lists[v].count; }
+	numUpEdges = upOffsets[numVertices];
+	upTargets = new int[numUpEdges];
+	upWeights = new int[numUpEdges];
+	upMiddle = new int[numUpEdges];
+	for (int v = 0; v < numVertices; v++) {
+		for (int i = 0; i < lists[v].count; i++) {
+			upTargets[upOffsets[v] + i] = lists[v].edges[i].target;
+			upWeights[upOffsets[v] + i] = lists[v].edges[i].weight;
+			upMiddle[upOffsets[v] + i] = lists[v].edges[i].middle;
+		}
+		delete[] lists[v].edges;
+	}
+	delete[] lists;
+	delete[] contractedNeighbours;
+	contractionVersion = mapVersion;
+}
+
+void Map::freeContraction() {
+	if (!contractionShared) {
+		delete[] contractionRank;
+		delete[] upOffsets;
+		delete[] upTargets;
+		delete[] upWeights;
+		delete[] upMiddle;
+	}
+	contractionRank = nullptr;
+	upOffsets = nullptr;
+	upTargets = nullptr;
+	upWeights = nullptr;
+	upMiddle = nullptr;
+	numUpEdges = 0;
+	numShortcuts = 0;
+	contractionVersion = -1;
+	contractionShared = false;
+}
+// Dijkstra's from source over the tiles not contracted yet, avoiding skip, until the neighbours of skip from index first on
+// are settled, or it passes distance limit or WITNESS_SETTLE_LIMIT tiles
+void Map::witnessSearch(ContractionList* lists, int source, int skip, int first, int limit, SearchContext& context) {
+	context.begin(numVertices);
+	context.heap.clear();
+	context.reach(source, 0, -1);
+	context.heap.push(source, 0);
+	int count = 0, remaining = lists[skip].count - first;
+	while (!context.heap.empty()) {
+		int u = context.heap.pop();
+		if (context.isSettled(u)) { continue; }
+		context.settle(u);
+		if (context.dist[u] > limit || ++count > WITNESS_SETTLE_LIMIT) { break; }
+		for (int i = first; i < lists[skip].count; i++) {
+			if (lists[skip].edges[i].target == u) { remaining--; }
+		}
+		if (remaining == 0) { break; }
+		for (int i = 0; i < lists[u].count; i++) {
+			int x = lists[u].edges[i].target;
+			int alt = context.dist[u] + lists[u].edges[i].weight;
+			if (x != skip && !context.isSettled(x) && (!context.reached(x) || alt < context.dist[x])) {
+				context.reach(x, alt, u);
+				context.heap.push(x, alt);
+			}
+		}
+	}
+}
+// counts the shortcuts contracting v needs, a pair of its neighbours needs one unless there is a path between them
+// that avoids v and is no longer than going through it. Adds them as well if apply is set.
+int Map::contractTile(ContractionList* lists, int v, bool apply, SearchContext& context) {
+	ContractionList& list = lists[v];
+	int shortcuts = 0;
+	for (int i = 0; i + 1 < list.count; i++) {
+		int u = list.edges[i].target, limit = 0;
+		for (int j = i + 1; j < list.count; j++) {
+			if (list.edges[i].weight + list.edges[j].weight > limit) { limit = list.edges[i].weight + list.edges[j].weight; }
+		}
+		witnessSearch(lists, u, v, i + 1, limit, context);
+		for (int j = i + 1; j < list.count; j++) {
+			int x = list.edges[j].target, through = list.edges[i].weight + list.edges[j].weight;
+			if (context.reached(x) && context.dist[x] <= through) { continue; } // dist is the length of a real path even if x is not settled
+			shortcuts++;
+			if (apply) { addShortcut(lists, u, x, through, v); }
+		}
+	}
+	return shortcuts;
+}
+
+void Map::addShortcut(ContractionList* lists, int u, int x, int weight, int middle) {
+	for (int side = 0; side < 2; side++) {
+		ContractionList& list = lists[side ? x : u];
+		int other = side ? u : x;
+		int i = 0;
+		while (i < list.count && list.edges[i].target != other) { i++; }
+		if (i == list.count) {
+			if (list.count == list.capacity) {
+				list.capacity *= 2;
+				ContractionEdge* temp = new ContractionEdge[list.capacity];
+				for (int k = 0; k < list.count; k++) { temp[k] = list.edges[k]; }
+				delete[] list.edges;
+				list.edges = temp;
+			}
+			list.count++;
+		}
+		else if (list.edges[i].weight <= weight) { continue; }
+		list.edges[i].target = other;
+		list.edges[i].weight = weight;
+		list.edges[i].middle = middle;
+	}
+}
+// stall on demand, u cannot be on a shortest path from the search's start if a tile above it already reaches it for less
+bool Map::stalled(const int* dist, const unsigned int* stamp, unsigned int epoch, int u) {
+	for (int i = upOffsets[u]; i < upOffsets[u + 1]; i++) {
+		int w = upTargets[i];
+		if (stamp[w] >= epoch && dist[w] + upWeights[i] < dist[u]) { return true; }
+	}
+	return false;
+}
+// the edge between two tiles is stored with whichever of them was contracted first
+int Map::upwardMiddle(int u, int v) {
+	int low = (contractionRank[u] < contractionRank[v]) ? u : v, high = (low == u) ? v : u;
+	for (int i = upOffsets[low]; i < upOffsets[low + 1]; i++) {
+		if (upTargets[i] == high) { return upMiddle[i]; }
+	}
+	return -1;
+}
+// searches upwards from both ends, the shortest path goes up from the source to its highest tile and down to the target.
+// The backward half stops once nothing it could still settle beats the best meeting so far. The first step is found by
+// unpacking the first edge of the path, a shortcut u-v through m starts with the edge u-m, until it is an actual step.
+int Map::contractionStep(int source, int target, SearchContext& context) {
+	if (source == target) { return source; }
+	if (!enemyPassable(source)) { return AStar(context, source, target); } // only the user stands on hidden tiles
+	if (!HasRule(EDGE_TERRAIN, terrainCode(target))) { return source; }
+	context.begin(numVertices);
+	context.heap.clear();
+	context.reach(source, 0, -1);
+	context.heap.push(source, 0);
+	int count = 0;
+	PROBE(int relaxed = 0, queueOps = 1;)
+	while (!context.heap.empty()) {
+		int u = context.heap.pop();
+		PROBE(queueOps++;)
+		if (context.isSettled(u)) { continue; }
+		context.settle(u);
+		count++;
+		if (stalled(context.dist, context.stamp, context.epoch, u)) { continue; }
+		for (int i = upOffsets[u]; i < upOffsets[u + 1]; i++) {
+			int v = upTargets[i], alt = context.dist[u] + upWeights[i];
+			if (!context.isSettled(v) && (!context.reached(v) || alt < context.dist[v])) {
+				context.reach(v, alt, u);
+				context.heap.push(v, alt);
+				PROBE(relaxed++; queueOps++;)
+			}
+		}
+	}
+
+	context.beginBackward(numVertices);
+	context.heap.clear();
+	if (enemyPassable(target)) {
+		context.backwardDist[target] = 0;
+		context.backwardPi[target] = -1;
+		context.backwardStamp[target] = context.backwardEpoch;
+		context.heap.push(target, 0);
+	}
+	else { // a hidden target is entered from one of its neighbours
+		for (int direction = 0; direction < 4; direction++) {
+			int n = neighbour(target, direction);
+			if (n >= 0 && enemyPassable(n) && (!context.backwardReached(n) || weightAt(n) + weightAt(target) < context.backwardDist[n])) {
+				context.backwardDist[n] = weightAt(n) + weightAt(target);
+				context.backwardPi[n] = target;
+				context.backwardStamp[n] = context.backwardEpoch;
+				context.heap.push(n, context.backwardDist[n]);
+			}
+		}
+	}
+	int best = INT_MAX, meeting = -1;
+	while (!context.heap.empty() && context.heap.minKey() < best) {
+		int u = context.heap.pop();
+		PROBE(queueOps++;)
+		if (context.backwardSettled(u)) { continue; }
+		context.backwardStamp[u] = context.backwardEpoch + 1;
+		count++;
+		if (context.isSettled(u) && context.dist[u] + context.backwardDist[u] < best) {
+			best = context.dist[u] + context.backwardDist[u];
+			meeting = u;
+		}
+		if (stalled(context.backwardDist, context.backwardStamp, context.backwardEpoch, u)) { continue; }
+		for (int i = upOffsets[u]; i < upOffsets[u + 1]; i++) {
+			int v = upTargets[i], alt = context.backwardDist[u] + upWeights[i];
+			if (!context.backwardSettled(v) && (!context.backwardReached(v) || alt < context.backwardDist[v])) {
+				context.backwardDist[v] = alt;
+				context.backwardPi[v] = u;
+				context.backwardStamp[v] = context.backwardEpoch;
+				context.heap.push(v, alt);
+				PROBE(relaxed++; queueOps++;)
+			}
+		}
+	}
+	settled = count;
+	PROBE(if (stats) { stats->recordSearch(count, relaxed, queueOps); })
+	if (meeting < 0) { return source; } // stays in place if the target cannot be reached
+
+	int next = meeting; // first tile after the source on the path through the hierarchy
+	if (meeting == source) {
+		next = context.backwardPi[source];
+		if (!enemyPassable(target) && next == target) { return target; } // hidden target right next to the source
+	}
+	else { while (context.pi[next] != source) { next = context.pi[next]; } }
+	for (int middle = upwardMiddle(source, next); middle >= 0; middle = upwardMiddle(source, next)) { next = middle; }
+	return next;
+}
+
+void Map::reserveSearches() { // enemy array may have grown since the searches were allocated
+	if (numSearches >= numEnemies) { return; }
+	IncrementalSearch* temp = new IncrementalSearch[enemiesSize];
+	for (int i = 0; i < enemiesSize; i++) {
+		if (i < numSearches) { temp[i] = searches[i]; }
+		else { temp[i].g = temp[i].rhs = temp[i].heap = temp[i].key1 = temp[i].key2 = temp[i].position = nullptr; }
+	}
+	delete[] searches;
+	searches = temp;
+	numSearches = enemiesSize;
+}
+
+void Map::freeSearches() {
+	for (int i = 0; i < numSearches; i++) {
+		delete[] searches[i].g;
+		delete[] searches[i].rhs;
+		delete[] searches[i].heap;
+		delete[] searches[i].key1;
+		delete[] searches[i].key2;
+		delete[] searches[i].position;
+	}
+	delete[] searches;
+	searches = nullptr;
+	numSearches = 0;
+}
+// starts a fresh D* Lite search, only the goal is queued until computeShortestPath runs
+void Map::initIncremental(IncrementalSearch& search, int start, int goal) {
+	if (!search.g) {
+		search.g = new int[numVertices];
+		search.rhs = new int[numVertices];
+		search.heap = new int[numVertices];
+		search.key1 = new int[numVertices];
+		search.key2 = new int[numVertices];
+		search.position = new int[numVertices];
+	}
+	for (int i = 0; i < numVertices; i++) {
+		search.g[i] = INCREMENTAL_INF;
+		search.rhs[i] = INCREMENTAL_INF;
+		search.position[i] = -1;
+	}
+	search.heapSize = 0;
+	search.km = 0;
+	search.start = start;
+	search.goal = goal;
+	search.version = mapVersion;
+	search.rhs[goal] = 0;
+	requeue(search, goal);
+}
+
+void Map::heapPlace(IncrementalSearch& search, int i, int vertex, int k1, int k2) {
+	search.heap[i] = vertex;
+	search.key1[i] = k1;
+	search.key2[i] = k2;
+	search.position[vertex] = i;
+}
+
+void Map::heapSiftUp(IncrementalSearch& search, int i) {
+	int vertex = search.heap[i], k1 = search.key1[i], k2 = search.key2[i];
+	while (i > 0 && keyLess(k1, k2, search.key1[(i - 1) / 2], search.key2[(i - 1) / 2])) {
+		int parent = (i - 1) / 2;
+		heapPlace(search, i, search.heap[parent], search.key1[parent], search.key2[parent]);
+		i = parent;
+	}
+	heapPlace(search, i, vertex, k1, k2);
+}
+
+void Map::heapSiftDown(IncrementalSearch& search, int i) {
+	int vertex = search.heap[i], k1 = search.key1[i], k2 = search.key2[i];
+	while (true) {
+		int child = 2 * i + 1;
+		if (child >= search.heapSize) { break; }
+		if (child + 1 < search.heapSize && keyLess(search.key1[child + 1], search.key2[child + 1], search.key1[child], search.key2[child])) { child++; }
+		if (!keyLess(search.key1[child], search.key2[child], k1, k2)) { break; }
+		heapPlace(search, i, search.heap[child], search.key1[child], search.key2[child]);
+		i = child;
+	}
+	heapPlace(search, i, vertex, k1, k2);
+}
+
+void Map::heapRemove(IncrementalSearch& search, int vertex) {
+	int i = search.position[vertex];
+	search.position[vertex] = -1;
+	search.heapSize--;
+	if (i == search.heapSize) { return; }
+	int moved = search.heap[search.heapSize]; // last entry fills the hole and may need to move either way
+	heapPlace(search, i, moved, search.key1[search.heapSize], search.key2[search.heapSize]);
+	heapSiftUp(search, i);
+	heapSiftDown(search, search.position[moved]);
+}
+// puts an inconsistent tile in the queue with its current key, or takes a consistent one out
+void Map::requeue(IncrementalSearch& search, int vertex) {
+	if (search.position[vertex] >= 0) { heapRemove(search, vertex); }
+	if (search.g[vertex] != search.rhs[vertex]) {
+		int best = (search.g[vertex] < search.rhs[vertex]) ? search.g[vertex] : search.rhs[vertex];
+		heapPlace(search, search.heapSize, vertex, best + heuristic(search.start, vertex) + search.km, best);
+		search.heapSize++;
+		heapSiftUp(search, search.heapSize - 1);
+	}
+}
+// recomputes rhs of a tile from its successors, moving onto a tile costs that tile's weight
+void Map::updateVertex(IncrementalSearch& search, int vertex) {
+	if (vertex != search.goal) {
+		int best = INCREMENTAL_INF;
+		if (HasRule(EDGE_TERRAIN, terrainCode(vertex))) {
+			for (int direction = 0; direction < 4; direction++) {
+				int v = neighbour(vertex, direction);
+				if (v >= 0 && enemyPassable(v) && search.g[v] + weightAt(v) < best) { best = search.g[v] + weightAt(v); }
+			}
+		}
+		search.rhs[vertex] = best;
+	}
+	requeue(search, vertex);
+}
+// D* Lite main loop, expands tiles until the enemy's tile is consistent and nothing queued can improve it
+void Map::computeShortestPath(IncrementalSearch& search) {
+	int count = 0;
+	PROBE(int updates = 0;)
+	int start = search.start;
+	while (search.heapSize > 0) {
+		int startBest = (search.g[start] < search.rhs[start]) ? search.g[start] : search.rhs[start];
+		if (!keyLess(search.key1[0], search.key2[0], startBest + search.km, startBest) && search.rhs[start] == search.g[start]) { break; }
+		int u = search.heap[0], old1 = search.key1[0], old2 = search.key2[0];
+		int best = (search.g[u] < search.rhs[u]) ? search.g[u] : search.rhs[u];
+		int new1 = best + heuristic(start, u) + search.km;
+		count++;
+		if (keyLess(old1, old2, new1, best)) { requeue(search, u); } // key is out of date because the enemy moved
+		else if (search.g[u] > search.rhs[u]) { // tile got cheaper, its predecessors may get cheaper too
+			search.g[u] = search.rhs[u];
+			heapRemove(search, u);
+			if (enemyPassable(u)) {
+				for (int direction = 0; direction < 4; direction++) {
+					int p = neighbour(u, direction);
+					if (p >= 0) {
+						updateVertex(search, p);
+						PROBE(updates++;)
+					}
+				}
+			}
+		}
+		else { // tile got more expensive, it and its predecessors have to be recomputed
+			search.g[u] = INCREMENTAL_INF;
+			updateVertex(search, u);
+			PROBE(updates++;)
+			if (enemyPassable(u)) {
+				for (int direction = 0; direction < 4; direction++) {
+					int p = neighbour(u, direction);
+					if (p >= 0) {
+						updateVertex(search, p);
+						PROBE(updates++;)
+					}
+				}
+			}
+		}
+	}
+	settled = count;
+	PROBE(if (stats) { stats->recordSearch(count, updates, count + updates); }) // every expansion and update is one requeue
+}
+// keeps a D* Lite search per enemy and only repairs the part of it affected by the enemy, the user or tiles moving
+int Map::incrementalStep(int enemy) {
+	if (enemy >= numSearches) { reserveSearches(); }
+	IncrementalSearch& search = searches[enemy];
+	int start = enemies[enemy].vertex, goal = user.vertex;
+	if (componentVersion != mapVersion) { buildComponents(); }
+	// the search is left as it is, the next one that can succeed moves its start and goal from where they were
+	if (!mayReach(start, goal)) { return start; }
+	if (!search.g || search.version != mapVersion) { initIncremental(search, start, goal); }
+	else {
+		if (start != search.start) { // keys stay comparable by adding how far the heuristic could have dropped
+			search.km += heuristic(search.start, start);
+			search.start = start;
+		}
+		if (goal != search.goal) { // moving the root only changes the rhs of the old and new goal tiles
+			int oldGoal = search.goal;
+			search.goal = goal;
+			search.rhs[goal] = 0;
+			requeue(search, goal);
+			updateVertex(search, oldGoal);
+		}
+	}
+	computeShortestPath(search);
+
+	if (start == goal || search.rhs[start] >= INCREMENTAL_INF) { return start; } // stays in place if the user cannot be reached
+	int next = start, best = INCREMENTAL_INF;
+	for (int direction = 0; direction < 4; direction++) { // steps to the successor the remaining distance was computed through
+		int v = neighbour(start, direction);
+		if (v >= 0 && enemyPassable(v) && search.g[v] + weightAt(v) < best) {
+			best = search.g[v] + weightAt(v);
+			next = v;
+		}
+	}
+	return next;
+}
+// picks the next step towards the user for an enemy using the selected chase mode
+int Map::nextStep(int enemy, SearchContext& context) {
+	if (chaseMode != CHASE_INCREMENTAL) { return pathStep(enemies[enemy].vertex, user.vertex, context); }
+	PROBE(long long start = stats ? NowNanos() : 0;)
+	int next = incrementalStep(enemy);
+	PROBE(if (stats) { stats->queryNanos.add(NowNanos() - start); })
+	return next;
+}
+// first step from source towards target with the selected chase mode, CHASE_INCREMENTAL needs an enemy so it uses A* here
+int Map::pathStep(int source, int target) {
+	refreshPathCache();
+	int next = pathStep(source, target, contexts[0]);
+	storePath(contexts[0]);
+	return next;
+}
+// the path behind a miss is left in context for the caller to store, planning threads only read the cache
+int Map::pathStep(int source, int target, SearchContext& context) {
+	PROBE(long long start = stats ? NowNanos() : 0;)
+	int next = cachesPaths() ? pathCache->find(source, target) : -1;
+	if (next < 0) {
+		next = findStep(source, target, context);
+		if (cachesPaths() && source != target) { context.tracePath(source, target); }
+	}
+	PROBE(if (stats) { stats->queryNanos.add(NowNanos() - start); })
+	return next;
+}
+// only Dijkstra's and A* paths are cached, the flow field already answers every enemy at once and the other modes do not
+// leave a whole shortest path in the context
+void Map::setPathCache(int entries) {
+	delete pathCache;
+	pathCache = (entries > 0) ? new PathCache(entries) : nullptr;
+	pathCacheVersion = -1;
+}
+// empties the cache once the tiles have changed in a way that could make a cached step wrong, see setTile
+void Map::refreshPathCache() {
+	if (!pathCache || pathCacheVersion == mapVersion) { return; }
+	pathCache->clear(numVertices);
+	pathCacheVersion = mapVersion;
+}
+
+void Map::storePath(SearchContext& context) {
+	if (context.pathLength > 0) { pathCache->store(context.path, context.pathLength, context.pathTarget); }
+	context.pathLength = 0;
+}
+
+int Map::findStep(int source, int target, SearchContext& context) {
+	if (componentVersion != mapVersion) { buildComponents(); }
+	if (!mayReach(source, target)) {
+		context.begin(numVertices); // nothing is settled, so tracePath finds no path either
+		settled = 0;
+		return source;
+	}
+	if (chaseMode == CHASE_FLOW_FIELD) {
+		updateFlowField(target);
+		return (flowNext[source] >= 0) ? flowNext[source] : source; // stays in place if the target cannot be reached
+	}
+	if (chaseMode == CHASE_ASTAR || chaseMode == CHASE_INCREMENTAL) { return AStar(context, source, target); }
+	if (chaseMode == CHASE_HIERARCHICAL) { return hierarchicalStep(source, target, context); }
+	if (chaseMode == CHASE_CONTRACTION) {
+		if (contractionVersion != mapVersion) { buildContraction(); }
+		return contractionStep(source, target, context);
+	}
+	if (chaseMode == CHASE_LANDMARKS) {
+		if (landmarkVersion != mapVersion) { buildLandmarks(numLandmarks ? numLandmarks : DEFAULT_LANDMARKS); }
+		return AStar(context, source, target);
+	}
+	return Dijkstra(context, source, target);
+}
+// function to check if a character following Rules can move in a certain direction
+template <class Rules> bool Map::canEnter(int vertex, int direction) {
+	int next = neighbour(vertex, direction);
+	return next >= 0 && occupancy[next] == OCCUPANT_NONE && Enters<Rules>(terrainCode(next));
+}
+// checks if enemy is adjacent to user
+bool Map::adjacentPlayer(int vertex) {
+	for (int direction = 0; direction < 4; direction++) {
+		if (user.vertex == neighbour(vertex, direction)) { return true; }
 	}
+	return false;
+}
+// checks whether each enemy can see the player, up to SIGHT_RADIUS tiles left, right, up or down with no wall in between
+void Map::setVisibility() {
+	PROBE(long long start = stats ? NowNanos() : 0;)
+	spotUser();
+	PROBE(if (stats) { stats->turnVisibility += NowNanos() - start; })
+}
 
+void Map::spotUser() {
+	if (sightVersion != mapVersion) { buildSight(); }
+	if (HasRule(HIDING_TERRAIN, terrainCode(user.vertex))) { return; } // enemies cannot see the user on a hidden tile
+	if (enemyAt) { // sight is symmetric, so the enemies that see the user are the ones standing in the user's own lines of sight
+		for (int direction = 0; direction < 4; direction++) {
+			int v = user.vertex;
+			for (int step = sightReach(user.vertex, direction); step > 0; step--) {
+				v = neighbour(v, direction);
+				if (enemyAt[v] >= 0) { enemies[enemyAt[v]].seesUser = true; }
+			}
+		}
+		return;
+	}
+	for (int i = 0; i < numEnemies; i++) {
+		if (inSight(enemies[i].vertex, user.vertex)) { enemies[i].seesUser = true; }
+	}
+}
+// true if to is in the same row or column as from and close enough that no wall or map edge is in between
+bool Map::inSight(int from, int to) {
+	int dx = to % width - from % width, dy = to / width - from / width;
+	if (dy == 0) { return (dx < 0) ? -dx <= sightReach(from, 2) : dx <= sightReach(from, 3); }
+	if (dx == 0) { return (dy < 0) ? -dy <= sightReach(from, 0) : dy <= sightReach(from, 1); }
 	return false;
 }
-// checks if enemy is adjacent to user
-bool Map::adjacentPlayer(int vertex) {
-	int rows = sqrt(numVertices);
-	if (user.vertex == vertex - rows || user.vertex == vertex + rows || user.vertex == vertex - 1 || user.vertex == vertex + 1) { return true; }
-	return false;
+
+void Map::setSightReach(int vertex, int direction, int reach) {
+	unsigned char& b = sight[2 * vertex + (direction < 2)];
+	b = (direction & 1) ? (unsigned char)((b & 15) | (reach << 4)) : (unsigned char)((b & 240) | reach);
+}
+// precomputes how far every tile can see in each direction from runs of clear tiles along each row and column. The runs
+// stop at tiles that block sight and at the map edges instead of wrapping onto the next row.
+void Map::buildSight() {
+	freeSight();
+	sight = new unsigned char[2 * (long long)numVertices]();
+	int rows = (numVertices + width - 1) / width;
+	for (int y = 0; y < rows; y++) {
+		int left = 0, right = 0; // clear tiles since the last one blocking sight
+		for (int x = 0; x < width; x++) {
+			int v = y * width + x, w = y * width + width - 1 - x;
+			if (v < numVertices) {
+				setSightReach(v, 2, min(left, SIGHT_RADIUS));
+				left = HasRule(OPAQUE_TERRAIN, terrainCode(v)) ? 0 : left + 1;
+			}
+			if (w < numVertices) {
+				setSightReach(w, 3, min(right, SIGHT_RADIUS));
+				right = HasRule(OPAQUE_TERRAIN, terrainCode(w)) ? 0 : right + 1;
+			}
+		}
+	}
+	for (int x = 0; x < width; x++) {
+		int up = 0, down = 0;
+		for (int y = 0; y < rows; y++) {
+			int v = y * width + x, w = (rows - 1 - y) * width + x;
+			if (v < numVertices) {
+				setSightReach(v, 0, min(up, SIGHT_RADIUS));
+				up = HasRule(OPAQUE_TERRAIN, terrainCode(v)) ? 0 : up + 1;
+			}
+			if (w < numVertices) {
+				setSightReach(w, 1, min(down, SIGHT_RADIUS));
+				down = HasRule(OPAQUE_TERRAIN, terrainCode(w)) ? 0 : down + 1;
+			}
+		}
+	}
+	sightVersion = mapVersion;
+}
+// a changed tile only affects the tiles that could see up to it, the ones within SIGHT_RADIUS in its row and column
+void Map::updateSight(int vertex) {
+	for (int direction = 0; direction < 4; direction++) {
+		int v = vertex;
+		for (int step = 0; step <= SIGHT_RADIUS && v >= 0; step++) {
+			for (int d = 0; d < 4; d++) {
+				int reach = 0;
+				for (int w = neighbour(v, d); w >= 0 && !HasRule(OPAQUE_TERRAIN, terrainCode(w)) && reach < SIGHT_RADIUS; w = neighbour(w, d)) { reach++; }
+				setSightReach(v, d, reach);
+			}
+			v = neighbour(v, direction);
+		}
+	}
+}
+
+void Map::freeSight() {
+	if (!sightShared) { delete[] sight; }
+	sight = nullptr;
+	sightVersion = -1;
+	sightShared = false;
+}
+// the occupancy layer only says what kind of character is on a tile, enemyAt says which enemy it is. It is built when a
+// map is loaded and kept up to date as enemies move, so it never goes stale.
+void Map::indexEnemies() {
+	freeEnemyIndex();
+	if (numEnemies <= INDEX_ENEMIES) { return; }
+	enemyAt = new int[numVertices];
+	for (int v = 0; v < numVertices; v++) { enemyAt[v] = -1; }
+	for (int i = 0; i < numEnemies; i++) { enemyAt[enemies[i].vertex] = i; }
+}
+
+void Map::freeEnemyIndex() {
+	delete[] enemyAt;
+	enemyAt = nullptr;
+}
+// moves an enemy in the occupancy layer and in the index if it is kept
+void Map::placeEnemy(int enemy, int vertex) {
+	int from = enemies[enemy].vertex;
+	occupancy[from] = OCCUPANT_NONE;
+	occupancy[vertex] = OCCUPANT_ENEMY;
+	enemies[enemy].vertex = vertex;
+	if (!enemyAt) { return; }
+	enemyAt[from] = -1;
+	enemyAt[vertex] = enemy;
+}
+// which enemy stands on a tile, -1 if none. Without the index there are at most INDEX_ENEMIES enemies to look through
+int Map::enemyOn(int vertex) {
+	if (occupancy[vertex] != OCCUPANT_ENEMY) { return -1; }
+	if (enemyAt) { return enemyAt[vertex]; }
+	for (int i = 0; i < numEnemies; i++) {
+		if (enemies[i].vertex == vertex) { return i; }
+	}
+	return -1;
+}
+// function used for enemy movement
+void Map::moveEnemies() {
+	refreshPathCache();
+	if (pool) {
+		moveEnemiesParallel();
+		setVisibility();
+		return;
+	}
+	for (int i = 0; i < numEnemies; i++) {
+		if (!enemies[i].seesUser) { // move randomly if user is not visible
+			int temp = rand() % 4;
+			// makes enemy wait a turn if it is unable to move to any spot around it
+			if (!canMove(enemies[i].vertex, 0) && !canMove(enemies[i].vertex, 1) && !canMove(enemies[i].vertex, 2) && !canMove(enemies[i].vertex, 3)) { temp = -1; }
+			else {
+				while (!canMove(enemies[i].vertex, temp)) { temp = rand() % 4; } // randomly pick a number from 0-3 until that number is a viable direction
+			}
+			if (temp >= 0) {
+				if (slowedDown(enemies[i])) { enemies[i].counter++; } // grass takes additional step to move through
+				else { moveEnemy(i, neighbour(enemies[i].vertex, temp)); }
+			}
+		}
+		else { // if enemy can see the user, either move using Dijkstra or move onto user space
+			if (slowedDown(enemies[i])) { enemies[i].counter++; }
+			else if (!adjacentPlayer(enemies[i].vertex)) {
+				PROBE(long long start = stats ? NowNanos() : 0;)
+				int next = nextStep(i, contexts[0]);
+				storePath(contexts[0]);
+				PROBE(if (stats) { stats->turnPathing += NowNanos() - start; })
+				if (occupancy[next] != OCCUPANT_ENEMY) { moveEnemy(i, next); }
+				enemies[i].counter = 0;
+			}
+			else { catchUser(i, rand()); }
+		}
+	}
+	setVisibility();
+}
+
+void Map::moveEnemy(int enemy, int next) {
+	placeEnemy(enemy, next);
+	enemies[enemy].counter = 0;
+}
+
+void Map::catchUser(int enemy, unsigned int random) {
+	placeEnemy(enemy, user.vertex);
+	int respawn = hiddenTiles[random % numHiddenTiles]; // moves user to random hidden tile if caught
+	user.vertex = respawn;
+	occupancy[respawn] = OCCUPANT_USER;
+	enemies[enemy].counter = 0;
+	user.counter = 0;
+	for (int i = 0; i < numEnemies; i++) { // when caught, enemies no longer see user
+		enemies[i].seesUser = false;
+	}
+	if (interactive) {
+		cout << "You've been caught! Respawning at random hidden tile...";
+		_getch();
+		ClearConsole();
+		printMap();
+	}
+}
+
+void Map::setThreads(int threads) {
+	delete pool;
+	delete[] contexts;
+	pool = (threads > 0) ? new ThreadPool(threads) : nullptr;
+	contexts = new SearchContext[pool ? pool->size() : 1];
+}
+// hashes the seed, turn and enemy index, so an enemy's choice does not depend on which thread plans it or in what order
+unsigned int Map::enemyRandom(int enemy) {
+	unsigned long long z = seed + 0x9E3779B97F4A7C15ULL * ((unsigned long long)turn * 0x10000ULL + enemy + 1);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return (unsigned int)(z ^ (z >> 31));
+}
+// decides what an enemy wants to do this turn, only reads the map so enemies can be planned at the same time
+void Map::planEnemy(int enemy, SearchContext& context) {
+	Characters& e = enemies[enemy];
+	EnemyPlan& plan = plans[enemy];
+	plan.action = PLAN_STAY;
+	plan.state = PLAN_PENDING;
+	plan.target = e.vertex;
+	plan.pathLength = 0;
+	bool onGrass = slowedDown(e); // grass takes additional step to move through
+	if (!e.seesUser) {
+		int directions[4], count = 0;
+		for (int direction = 0; direction < 4; direction++) {
+			if (canMove(e.vertex, direction)) { directions[count++] = direction; }
+		}
+		if (count == 0) { return; } // waits a turn if it is unable to move to any spot around it
+		if (onGrass) { plan.action = PLAN_GRASS; }
+		else {
+			plan.action = PLAN_WANDER;
+			plan.target = neighbour(e.vertex, directions[enemyRandom(enemy) % count]);
+		}
+	}
+	else if (onGrass) { plan.action = PLAN_GRASS; }
+	else if (!adjacentPlayer(e.vertex)) {
+		plan.action = PLAN_CHASE;
+		chasePlans++;
+		plan.target = nextStep(enemy, context);
+		if (context.pathLength > 0) { // the plan takes the path over, so storing it in enemy order keeps turns reproducible
+			swap(plan.path, context.path);
+			swap(plan.pathSize, context.pathSize);
+			plan.pathLength = context.pathLength;
+			plan.pathTarget = context.pathTarget;
+			context.pathLength = 0;
+		}
+	}
+	else { plan.action = PLAN_CATCH; }
+}
+// plans every enemy on the thread pool against the map as it was at the start of the turn, then applies the plans in
+// enemy order. Every enemy moving reserves its target first, so two enemies wanting one tile go to the earlier one.
+// An enemy whose target holds another enemy that is moving away this turn lets that enemy go first and follows it, a
+// plan that still conflicts (tile taken or kept, user already caught) is dropped.
+void Map::moveEnemiesParallel() {
+	if (plansSize < numEnemies) {
+		delete[] plans;
+		delete[] waiting;
+		plansSize = enemiesSize;
+		plans = new EnemyPlan[plansSize];
+		waiting = new int[plansSize];
+		delete[] reserved;
+		reservationSlots = 1;
+		while (reservationSlots < 2 * plansSize) { reservationSlots *= 2; }
+		reserved = new int[reservationSlots];
+	}
+	// everything planning could lazily build is built up front so the planning threads only read shared state
+	if (componentVersion != mapVersion) { buildComponents(); }
+	if (chaseMode == CHASE_FLOW_FIELD) { updateFlowField(user.vertex); }
+	if (chaseMode == CHASE_INCREMENTAL) { reserveSearches(); }
+	if (chaseMode == CHASE_LANDMARKS && landmarkVersion != mapVersion) { buildLandmarks(numLandmarks ? numLandmarks : DEFAULT_LANDMARKS); }
+	if (chaseMode == CHASE_CONTRACTION && contractionVersion != mapVersion) { buildContraction(); }
+	PROBE(long long start = stats ? NowNanos() : 0;)
+	if (chaseMode == CHASE_HIERARCHICAL && hierarchyVersion != mapVersion) { buildHierarchy(clusterSize ? clusterSize : 10); }
+	chasePlans = 0;
+	pool->run(numEnemies, [this](int task, int worker) { planEnemy(task, contexts[worker]); }); // each thread searches with its own scratch
+	PROBE(if (stats) { stats->turnPathing += NowNanos() - start; })
+
+	// only a chase can make an enemy move ahead of its turn, so without one the plans are applied in enemy order and the
+	// occupancy layer alone gives every tile to the first enemy wanting it
+	if (chasePlans == 0) {
+		for (int i = 0; i < numEnemies; i++) {
+			if (plans[i].pathLength > 0) { pathCache->store(plans[i].path, plans[i].pathLength, plans[i].pathTarget); }
+			applyPlan(i, true);
+		}
+		turn++;
+		return;
+	}
+	auto moving = [this](int enemy) { return plans[enemy].action == PLAN_WANDER || plans[enemy].action == PLAN_CHASE; };
+	for (int slot = 0; slot < reservationSlots; slot++) { reserved[slot] = -1; }
+	for (int i = 0; i < numEnemies; i++) {
+		EnemyPlan& plan = plans[i];
+		if (plan.pathLength > 0) { pathCache->store(plan.path, plan.pathLength, plan.pathTarget); }
+		plan.claimed = moving(i) && claimTile(plan.target);
+	}
+	for (int i = 0; i < numEnemies; i++) {
+		if (plans[i].state != PLAN_PENDING) { continue; } // already moved out of the way of an earlier enemy
+		int numWaiting = 0;
+		for (int enemy = i; plans[enemy].state == PLAN_PENDING;) { // wander targets were free at the start of the turn
+			plans[enemy].state = PLAN_WAITING;
+			waiting[numWaiting++] = enemy;
+			int blocker = (plans[enemy].action == PLAN_CHASE) ? enemyOn(plans[enemy].target) : -1;
+			if (blocker < 0 || !moving(blocker)) { break; }
+			enemy = blocker;
+		}
+		while (numWaiting > 0) {
+			int enemy = waiting[--numWaiting];
+			plans[enemy].state = PLAN_APPLIED;
+			applyPlan(enemy, plans[enemy].claimed);
+		}
+	}
+	turn++;
+}
+// adds tile to the reservation table, false if another enemy reserved it first. The table is sized by the number of
+// enemies rather than tiles, so it stays in cache however big the map is.
+bool Map::claimTile(int tile) {
+	int slot = (int)(((unsigned long long)tile * 0x9E3779B97F4A7C15ULL) >> 32) & (reservationSlots - 1);
+	while (reserved[slot] >= 0) {
+		if (reserved[slot] == tile) { return false; }
+		slot = (slot + 1) & (reservationSlots - 1);
+	}
+	reserved[slot] = tile;
+	return true;
+}
+
+// claimed is false when another enemy reserved the target first
+void Map::applyPlan(int enemy, bool claimed) {
+	EnemyPlan& plan = plans[enemy];
+	if (plan.action == PLAN_GRASS) { enemies[enemy].counter++; }
+	else if (plan.action == PLAN_WANDER) {
+		if (claimed && freeGround(plan.target)) { moveEnemy(enemy, plan.target); }
+	}
+	else if (plan.action == PLAN_CHASE && enemies[enemy].seesUser) {
+		if (claimed && occupancy[plan.target] != OCCUPANT_ENEMY) { moveEnemy(enemy, plan.target); }
+		enemies[enemy].counter = 0;
+	}
+	else if (plan.action == PLAN_CATCH && enemies[enemy].seesUser && adjacentPlayer(enemies[enemy].vertex)) { catchUser(enemy, enemyRandom(enemy)); }
+}
+
+void Map::move(char direction) { // main movement function since user moves before enemies
+	int n;
+	direction = tolower(direction);
+	if (direction == 'w' || direction == 'W') { n = 0; } // checks for valid direction
+	else if (direction == 's' || direction == 'S') { n = 1; }
+	else if (direction == 'a' || direction == 'A') { n = 2; }
+	else if (direction == 'd' || direction == 'D') { n = 3; }
+	else { n = -1; }
+	if (n >= 0) {
+		if (canEnter<PlayerRules>(user.vertex, n)) { // player can move where enemies can but also to hidden tiles
+			if (slowedDown(user)) { user.counter++; } // grass takes additional step to move through
+			else {
+				occupancy[user.vertex] = OCCUPANT_NONE;
+				user.vertex = neighbour(user.vertex, n);
+				occupancy[user.vertex] = OCCUPANT_USER;
+				user.counter = 0;
+			}
+			if (HasRule(HIDING_TERRAIN, terrainCode(user.vertex))) { // enemies lose sight of user if user is on hidden tile
+				for (int i = 0; i < numEnemies; i++) {
+					enemies[i].seesUser = false;
+				}
+			}
+			moveEnemies(); // enemies move after user
+		}
+	}
+	setVisibility(); // after all movement, check if enemies can see user
+}
+// acts as a destructor then constructor to reset instance of Map to allow for current map to be overwritten
+void Map::reset() {
+	closeCompiled();
+	freeTerrain();
+	delete[] occupancy;
+	delete[] enemies;
+	delete[] flowDist;
+	delete[] flowNext;
+	freeHierarchy();
+	freeComponents();
+	freeLandmarks();
+	freeContraction();
+	freeSight();
+	freeEnemyIndex();
+	freeSearches();
+
+	numVertices = 0;
+	terrain = new unsigned char[(mapSize + 3) / 4];
+	occupancy = new unsigned char[mapSize];
+	flowDist = nullptr;
+	flowNext = nullptr;
+	flowTarget = -1;
+	mapVersion++;
+	numEnemies = 0;
+	enemies = new Characters[enemiesSize];
+	numHiddenTiles = 0;
+	hiddenTiles = new int[hiddenSize];
+}
+
+void Map::prepareSharing() {
+	if (sightVersion != mapVersion) { buildSight(); }
+	if (componentVersion != mapVersion) { buildComponents(); }
+	if (chaseMode == CHASE_HIERARCHICAL && hierarchyVersion != mapVersion) { buildHierarchy(clusterSize ? clusterSize : 10); }
+	if (chaseMode == CHASE_LANDMARKS && landmarkVersion != mapVersion) { buildLandmarks(numLandmarks ? numLandmarks : DEFAULT_LANDMARKS); }
+	if (chaseMode == CHASE_CONTRACTION && contractionVersion != mapVersion) { buildContraction(); }
+}
+// starts a new game on source's map. The characters are copied, while the terrain and every search structure source has
+// built are read from source in place, so many sessions of one map keep a single copy of them. source must outlive this
+// map and stay unchanged while it is shared, this map copies the terrain the first time setTile changes it.
+void Map::shareFrom(Map& source) {
+	closeCompiled();
+	freeTerrain();
+	freeHierarchy();
+	freeComponents();
+	freeLandmarks();
+	freeContraction();
+	freeSight();
+	freeSearches();
+	mapVersion++;
+	reserve(source.numVertices, source.numEnemies, source.numHiddenTiles);
+	freeTerrain(); // reserve allocates terrain when there is none
+	terrain = source.terrain;
+	terrainMapped = true;
+	terrainShared = true;
+	memcpy(occupancy, source.occupancy, source.numVertices);
+	for (int i = 0; i < source.numEnemies; i++) { enemies[i] = source.enemies[i]; }
+	if (source.numHiddenTiles > 0) { memcpy(hiddenTiles, source.hiddenTiles, sizeof(int) * source.numHiddenTiles); }
+	user = source.user;
+	numVertices = source.numVertices;
+	numEnemies = source.numEnemies;
+	numHiddenTiles = source.numHiddenTiles;
+	width = source.width;
+	height = source.height;
+	maxWeight = source.maxWeight;
+	minWeight = source.minWeight;
+	turn = 0;
+	if (graphType == CSR_GRAPH && source.graphType == CSR_GRAPH && source.edgesVersion == source.mapVersion) {
+		edgeOffsets = source.edgeOffsets;
+		edgeTargets = source.edgeTargets;
+		edgeWeights = source.edgeWeights;
+		numEdges = source.numEdges;
+		edgesMapped = true;
+		edgesVersion = mapVersion;
+	}
+	if (source.landmarkVersion == source.mapVersion) {
+		landmarks = source.landmarks;
+		landmarkDist = source.landmarkDist;
+		numLandmarks = source.numLandmarks;
+		landmarksMapped = true;
+		landmarkVersion = mapVersion;
+	}
+	if (source.hierarchyVersion == source.mapVersion) {
+		clusterSize = source.clusterSize;
+		clustersWide = source.clustersWide;
+		clustersHigh = source.clustersHigh;
+		clusters = source.clusters;
+		nodeSlot = source.nodeSlot;
+		hierarchyShared = true;
+		hierarchyVersion = mapVersion;
+	}
+	if (source.componentVersion == source.mapVersion) {
+		component = source.component;
+		componentTiles = source.componentTiles;
+		componentBoxes = source.componentBoxes;
+		componentQueue = source.componentQueue; // only written by updates, which free shared components first
+		numComponents = source.numComponents;
+		componentsSize = source.componentsSize;
+		liveComponents = source.liveComponents;
+		componentsShared = true;
+		componentVersion = mapVersion;
+	}
+	if (source.contractionVersion == source.mapVersion) {
+		contractionRank = source.contractionRank;
+		upOffsets = source.upOffsets;
+		upTargets = source.upTargets;
+		upWeights = source.upWeights;
+		upMiddle = source.upMiddle;
+		numUpEdges = source.numUpEdges;
+		numShortcuts = source.numShortcuts;
+		contractionShared = true;
+		contractionVersion = mapVersion;
+	}
+	if (source.sightVersion == source.mapVersion) {
+		sight = source.sight;
+		sightShared = true;
+		sightVersion = mapVersion;
+	}
+	indexEnemies();
+}
+// function to print main menu
+void PrintMenu() {
+	cout << "\n\n";
+	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 9);
+	cout << "       _____  _ _ _        _             _        _____ _                _            _     _____      _   _     " << endl;
+	cout << "      |  __ \\(_|_) |      | |           ( )      / ____| |              | |          | |   |  __ \\    | | | |    " << endl;
+	cout << "      | |  | |_ _| | _____| |_ _ __ __ _|/ ___  | (___ | |__   ___  _ __| |_ ___  ___| |_  | |__) |_ _| |_| |__  " << endl;
+	cout << "      | |  | | | | |/ / __| __| '__/ _` | / __|  \\___ \\| '_ \\ / _ \\| '__| __/ _ \\/ __| __| |  ___/ _` | __| '_ \\ " << endl;
+	cout << "      | |__| | | |   <\\__ \\ |_| | | (_| | \\__ \\  ____) | | | | (_) | |  | ||  __/\\__ \\ |_  | |  | (_| | |_| | | |" << endl;
+	cout << "      |_____/|_| |_|\\_\\___/\\__|_|  \\__,_| |___/ |_____/|_| |_|\\___/|_|   \\__\\___||___/\\__| |_|   \\__,_|\\__|_| |_|" << endl;
+	cout << "              _/ |                                                                                               " << endl;
+	cout << "             |__/" << endl;
+	cout << "  __-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__";
+	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 7);
+	cout << "\n\n\n\n\t\t\t\t\t\t     MAIN MENU\n\n";
+	cout << "\t\t\t\t\t\tw. Start/continue game\n";
+	cout << "\t\t\t\t\t\ta. View example map\n";
+	cout << "\t\t\t\t\t\ts. Controls and info\n";
+	cout << "\t\t\t\t\t\td. Reset\n";
+	cout << "\t\t\t\t\t\tq. Quit game\n";
+	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 15);
+}
+
+char GetInput() { // gets user input using getch, accounts for capitalization
+	cout << "\n\n\t\t\t\t\t\tEnter choice:";
+	char temp = _getch();
+	temp = tolower(temp);
+	return temp;
+}
+FrameRenderer::FrameRenderer() {
+	frame = nullptr;
+	frameWidth = 0;
+	frameHeight = 0;
+	viewWidth = 40;
+	viewHeight = 20;
+	originX = 0;
+	originY = 0;
+	clears = 0;
+#ifdef _WIN32
+	HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE); // the Windows 10 console understands the same escape sequences once asked to
+	DWORD mode = 0;
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+	if (GetConsoleMode(console, &mode)) { SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING); }
+#endif
+}
+
+void FrameRenderer::setViewport(int width, int height) {
+	viewWidth = max(width, 1);
+	viewHeight = max(height, 1);
+}
+
+void FrameRenderer::fitTerminal() { // leaves the tab in front of each row and a few lines below the map for messages
+	int columns, rows;
+	if (TerminalSize(columns, rows)) { setViewport((columns - 8) / 2, rows - 3); }
+}
+// moves the window along one axis so the user stays a quarter of the window away from its edges
+void FrameRenderer::scroll(int& origin, int position, int view, int size) {
+	int margin = view / 4;
+	if (position < origin + margin) { origin = position - margin; }
+	if (position >= origin + view - margin) { origin = position - view + margin + 1; }
+	origin = max(0, min(origin, size - view));
+}
+
+void FrameRenderer::draw(Map& map) {
+	int width = min(viewWidth, map.getWidth());
+	int height = min(viewHeight, map.getHeight());
+	int user = map.getUserVertex();
+	scroll(originX, user % map.getWidth(), width, map.getWidth());
+	scroll(originY, user / map.getWidth(), height, map.getHeight());
+	buffer.clear();
+	if (width != frameWidth || height != frameHeight || clears != ScreenClears()) { // scrolling keeps the frame, it is compared by screen position
+		delete[] frame; // the old frame no longer matches the screen, start again from a blank one
+		frame = new char[width * height]();
+		frameWidth = width;
+		frameHeight = height;
+		clears = ScreenClears();
+		buffer += "\x1b[2J";
+	}
+	int cursorRow = -1, cursorColumn = -1, color = -1;
+	char position[32];
+	for (int row = 0; row < height; row++) {
+		int vertex = (originY + row) * map.getWidth() + originX;
+		for (int column = 0; column < width; column++, vertex++) {
+			char symbol = map.symbolAt(vertex);
+			char& shown = frame[row * width + column];
+			if (shown == symbol) { continue; }
+			shown = symbol;
+			if (row != cursorRow || column != cursorColumn) { // a run of changed tiles only needs the cursor moved once
+				snprintf(position, sizeof(position), "\x1b[%d;%dH", row + 1, column * 2 + 9);
+				buffer += position;
+			}
+			if (SymbolColor(symbol) != color) { // and a run of one color only needs the color set once
+				color = SymbolColor(symbol);
+				snprintf(position, sizeof(position), "\x1b[%dm", AnsiColor(color));
+				buffer += position;
+			}
+			buffer += symbol;
+			buffer += ' ';
+			cursorRow = row;
+			cursorColumn = column + 1;
+		}
+	}
+	if (color != -1 && color != 15) {
+		snprintf(position, sizeof(position), "\x1b[%dm", AnsiColor(15)); // resets text color to white
+		buffer += position;
+	}
+	if (!buffer.empty()) { // leaves the cursor under the map for any message
+		snprintf(position, sizeof(position), "\x1b[%d;1H", height + 1);
+		buffer += position;
+	}
+	cout.write(buffer.data(), buffer.size());
+	cout.flush();
+}
+
+unsigned int NextRandom(unsigned int& state) { // xorshift, rand() only goes up to 32767 on some compilers which is too small for big maps
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+// writes a synthetic map of the given type ("maze", "open", "grass" or "hidden") with a player and some enemies
+bool GenerateMap(string type, int width, int height, int numEnemies, unsigned int seed, string filename) {
+	if (width < 5 || height < 5) { return false; }
+	unsigned int state = seed ? seed : 1;
+	long long size = (long long)width * height;
+	char* tiles = new char[size];
+	if (type == "maze") { // recursive backtracker on the odd cells, then some extra openings so there are loops
+		for (long long i = 0; i < size; i++) { tiles[i] = 'X'; }
+		int cellsWide = (width - 1) / 2, cellsHigh = (height - 1) / 2;
+		int* stack = new int[cellsWide * cellsHigh];
+		int top = 0;
+		stack[top++] = 0;
+		tiles[width + 1] = '_';
+		while (top > 0) {
+			int cell = stack[top - 1], cx = cell % cellsWide, cy = cell / cellsWide;
+			int options[4], count = 0;
+			if (cy > 0 && tiles[(2 * cy - 1) * width + 2 * cx + 1] == 'X') { options[count++] = cell - cellsWide; }
+			if (cy < cellsHigh - 1 && tiles[(2 * cy + 3) * width + 2 * cx + 1] == 'X') { options[count++] = cell + cellsWide; }
+			if (cx > 0 && tiles[(2 * cy + 1) * width + 2 * cx - 1] == 'X') { options[count++] = cell - 1; }
+			if (cx < cellsWide - 1 && tiles[(2 * cy + 1) * width + 2 * cx + 3] == 'X') { options[count++] = cell + 1; }
+			if (count == 0) {
+				top--;
+				continue;
+			}
+			int next = options[NextRandom(state) % count], nx = next % cellsWide, ny = next / cellsWide;
+			tiles[(cy + ny + 1) * width + cx + nx + 1] = '_'; // wall between the two cells
+			tiles[(2 * ny + 1) * width + 2 * nx + 1] = '_';
+			stack[top++] = next;
+		}
+		delete[] stack;
+		for (long long i = 0; i < size / 20; i++) {
+			int x = 1 + NextRandom(state) % (width - 2), y = 1 + NextRandom(state) % (height - 2);
+			tiles[y * width + x] = '_';
+		}
+	}
+	else {
+		int wallPercent = 8, grassPercent = (type == "grass") ? 50 : 10, hiddenPercent = (type == "hidden") ? 20 : 1;
+		for (long long i = 0; i < size; i++) {
+			int roll = NextRandom(state) % 100;
+			tiles[i] = (roll < wallPercent) ? 'X' : (roll < wallPercent + grassPercent) ? '-' : (roll < wallPercent + grassPercent + hiddenPercent) ? 'H' : '_';
+		}
+	}
+	for (int x = 0; x < width; x++) { // border walls
+		tiles[x] = 'X';
+		tiles[(long long)(height - 1) * width + x] = 'X';
+	}
+	for (int y = 0; y < height; y++) {
+		tiles[(long long)y * width] = 'X';
+		tiles[(long long)y * width + width - 1] = 'X';
+	}
+	// a few hidden tiles so a caught player always has somewhere to respawn, then the player and the enemies
+	int placed[3] = { 0, 0, 0 }, wanted[3] = { (int)(size / 500) + 1, 1, numEnemies };
+	const char symbols[3] = { 'H', 'O', '#' };
+	for (int k = 0; k < 3; k++) {
+		for (long long attempts = 0; placed[k] < wanted[k] && attempts < size * 4; attempts++) {
+			long long i = ((long long)NextRandom(state) * 65536 + NextRandom(state) % 65536) % size;
+			if (tiles[i] == '_') {
+				tiles[i] = symbols[k];
+				placed[k]++;
+			}
+		}
+	}
+	ofstream outFS(filename, ios::binary);
+	char* row = new char[width + 1];
+	row[width] = '\n';
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) { row[x] = tiles[(long long)y * width + x]; }
+		outFS.write(row, (y < height - 1) ? width + 1 : width);
+	}
+	delete[] row;
+	delete[] tiles;
+	return outFS.good();
+}
+
+struct Settings { // options shared by the headless commands
+	ChaseMode mode;
+	QueueType queue;
+	GraphType graph;
+	int threads;
+	int turns;
+	int queries;
+	int clusterSize;
+	int landmarks; // 0 uses DEFAULT_LANDMARKS, and --compile only stores landmarks if it is set
+	int enemies;
+	int pathCache; // entries in the path cache, 0 searches for every step
+	int chunks; // chunks --world holds in memory
+	unsigned int seed;
+	string script; // file of move keys replayed by --simulate and --world, random moves if empty
+	string stats; // file --simulate and --bench write their instrumentation to, nothing is recorded if empty
+	string socket; // Unix socket --host listens on, stdin if empty
+};
+
+void ApplySettings(Map& map, Settings& settings) { // call before loading a map
+	map.setChaseMode(settings.mode);
+	map.setPathCache(settings.pathCache);
+	map.setQueueType(settings.queue);
+	map.setGraphType(settings.graph);
+	map.setThreads(settings.threads);
+	map.setSeed(settings.seed);
+	map.setInteractive(false);
+}
+
+string ReadMoves(string filename) { // move keys in a --script file, empty if there is none
+	string moves;
+	if (filename.empty()) { return moves; }
+	ifstream inFS(filename);
+	char key;
+	while (inFS.get(key)) {
+		if (key == 'w' || key == 'a' || key == 's' || key == 'd' || key == ' ') { moves += key; }
+	}
+	return moves;
+}
+
+double ElapsedSeconds(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+// replays a move stream through Map::move without rendering and reports throughput and per-turn latency
+int RunSimulation(string filename, Settings& settings) {
+	Map map(1024);
+	ApplySettings(map, settings);
+	map.mapFromFile(filename);
+	if (map.getNumVertices() == 0) {
+		cout << "Could not load " << filename << "\n";
+		return 1;
+	}
+	map.mapToGraph();
+	if (settings.mode == CHASE_HIERARCHICAL) { map.buildHierarchy(settings.clusterSize); }
+	if (settings.mode == CHASE_LANDMARKS && map.getNumLandmarks() == 0) { map.buildLandmarks(settings.landmarks ? settings.landmarks : DEFAULT_LANDMARKS); }
+
+	string moves = ReadMoves(settings.script);
+	Instrumentation stats;
+	bool record = !settings.stats.empty();
+	if (record) { map.setInstrumentation(&stats); }
+	unsigned int state = settings.seed ? settings.seed : 1;
+	double* latencies = new double[settings.turns];
+	auto start = chrono::steady_clock::now();
+	for (int t = 0; t < settings.turns; t++) {
+		char key = moves.empty() ? "wasd "[NextRandom(state) % 5] : moves[t % moves.size()];
+		auto turnStart = chrono::steady_clock::now();
+		PROBE(if (record) { stats.beginTurn(); })
+		if (key == ' ') { map.moveEnemies(); }
+		else { map.move(key); }
+		PROBE(if (record) { stats.endTurn(); })
+		latencies[t] = ElapsedSeconds(turnStart) * 1e6;
+	}
+	double total = ElapsedSeconds(start);
+	sort(latencies, latencies + settings.turns);
+	cout << filename << ": " << map.getNumVertices() << " tiles, " << map.getNumEnemies() << " enemies, " << settings.turns << " turns\n";
+	cout << "turns/sec " << settings.turns / total << "\n";
+	cout << "latency us  p50 " << latencies[settings.turns / 2] << "  p90 " << latencies[settings.turns * 9 / 10]
+		<< "  p99 " << latencies[settings.turns * 99 / 100] << "  max " << latencies[settings.turns - 1] << "\n";
+	long long lookups = map.getPathCacheHits() + map.getPathCacheMisses();
+	if (lookups > 0) { cout << "path cache hits " << map.getPathCacheHits() << "  misses " << map.getPathCacheMisses() << "  (" << 100.0 * map.getPathCacheHits() / lookups << "% of steps without a search)\n"; }
+	delete[] latencies;
+	if (record && !stats.dump(settings.stats)) {
+		cout << "Could not write " << settings.stats << "\n";
+		return 1;
+	}
+	return 0;
+}
+// tiles enemies can stand on, the query loops below draw from these and would never finish on a map without any
+int OpenTiles(Map& map) {
+	int open = 0;
+	for (int v = 0; v < map.getNumVertices(); v++) { open += Enters<EnemyRules>(map.terrainAt(v)); }
+	return open;
+}
+// random pairs of tiles enemies can stand on, only call it when OpenTiles is not 0
+void RandomQueries(Map& map, int* sources, int* targets, int count, unsigned int& state) {
+	for (int q = 0; q < count; q++) {
+		do { sources[q] = NextRandom(state) % map.getNumVertices(); } while (!Enters<EnemyRules>(map.terrainAt(sources[q])));
+		do { targets[q] = NextRandom(state) % map.getNumVertices(); } while (!Enters<EnemyRules>(map.terrainAt(targets[q])));
+	}
+}
+// times looking up the enemy on a tile with the occupancy index against looking through every enemy, on the enemies of
+// the loaded map
+void BenchOccupancy(Map& map, Settings& settings) {
+	int numEnemies = map.getNumEnemies(), lookups = settings.queries * 100;
+	if (numEnemies == 0) { return; }
+	int* tiles = new int[lookups];
+	unsigned int state = settings.seed ? settings.seed : 1;
+	for (int q = 0; q < lookups; q++) { // half the tiles have an enemy on them
+		tiles[q] = (q % 2) ? map.getEnemyVertex(NextRandom(state) % numEnemies) : NextRandom(state) % map.getNumVertices();
+	}
+	long long indexed = 0, scanned = 0;
+	auto start = chrono::steady_clock::now();
+	for (int q = 0; q < lookups; q++) { indexed += map.enemyOn(tiles[q]); }
+	double onTime = ElapsedSeconds(start);
+	start = chrono::steady_clock::now();
+	for (int q = 0; q < lookups; q++) {
+		int enemy = numEnemies - 1;
+		while (enemy >= 0 && map.getEnemyVertex(enemy) != tiles[q]) { enemy--; }
+		scanned += enemy;
+	}
+	double onScanTime = ElapsedSeconds(start);
+	cout << "  " << numEnemies << " enemies, enemy on tile " << onTime * 1e9 / lookups << " ns indexed, " << onScanTime * 1e9 / lookups
+		<< " ns scanning" << ((indexed == scanned) ? "" : " (results differ)") << "\n";
+	delete[] tiles;
 }
-// This function checks 8 tiles left, right, up and down to see if the player is visible to the enemy
-void Map::setVisibility() {
-	for (int i = 0; i < numEnemies; i++) {
-		int counter = 1;
-		int up = enemies[i].vertex, down = enemies[i].vertex, left = enemies[i].vertex, right = enemies[i].vertex, rows = sqrt(numVertices);
-		while (counter <= 8) {
-			if (map[up].symbol != 'X' && enemies[i].vertex - (rows * counter) >= 0) { up = enemies[i].vertex - (rows * counter); }
-			if (map[down].symbol != 'X' && enemies[i].vertex + (rows * counter) < numVertices) { down = enemies[i].vertex + (rows * counter); }
-			if (map[left].symbol != 'X' && enemies[i].vertex - counter >= 0) { left = enemies[i].vertex - counter; }
-			if (map[right].symbol != 'X' && enemies[i].vertex + counter < numVertices) { right = enemies[i].vertex + counter; }
-			if (map[up].symbol == 'O' && user.tile != 'H') { enemies[i].seesUser = true; }
-			if (map[down].symbol == 'O' && user.tile != 'H') { enemies[i].seesUser = true; }
-			if (map[left].symbol == 'O' && user.tile != 'H') { enemies[i].seesUser = true; }
-			if (map[right].symbol == 'O' && user.tile != 'H') { enemies[i].seesUser = true; }
 
-			counter++;
-		}
+// reports the components of the loaded map, and times the reachability test and the relabelling setTile does when a tile
+// closes and opens again
+void BenchReachability(Map& map, Settings& settings) {
+	int labels = map.getComponentLabels(), largest = -1, queries = settings.queries * 100, numVertices = map.getNumVertices();
+	for (int c = 0; c < labels; c++) {
+		if (map.getComponentSize(c) > 0 && (largest < 0 || map.getComponentSize(c) > map.getComponentSize(largest))) { largest = c; }
+	}
+	if (largest < 0) { return; }
+	ComponentBox box = map.getComponentBox(largest);
+	cout << "  " << map.getNumComponents() << " components, largest " << map.getComponentSize(largest) << " tiles in columns "
+		<< box.left << "-" << box.right << ", rows " << box.top << "-" << box.bottom << "\n";
+	int* pairs = new int[2 * queries];
+	unsigned int state = settings.seed ? settings.seed : 1;
+	for (int q = 0; q < 2 * queries; q++) { // same kind of tiles as the path queries
+		do { pairs[q] = NextRandom(state) % numVertices; } while (!Enters<EnemyRules>(map.terrainAt(pairs[q])));
 	}
+	int reachable = 0;
+	auto start = chrono::steady_clock::now();
+	for (int q = 0; q < queries; q++) { reachable += map.mayReach(pairs[2 * q], pairs[2 * q + 1]); }
+	double reachTime = ElapsedSeconds(start);
+	int updates = 0;
+	start = chrono::steady_clock::now();
+	for (int q = 0; q < 2 * queries && updates < 1000; q++) { // walls up a free tile and clears it again, splitting and merging
+		int v = pairs[q];
+		char tile = map.tileAt(v);
+		if (map.symbolAt(v) != tile) { continue; } // a character is standing on it
+		map.setTile(v, 'X');
+		map.setTile(v, tile);
+		updates += 2;
+	}
+	double updateTime = ElapsedSeconds(start);
+	cout << "  reachability " << reachTime * 1e9 / queries << " ns/query, " << 100.0 * (queries - reachable) / queries
+		<< "% of random pairs cannot be reached";
+	if (updates > 0) { cout << ", setTile with relabelling " << updateTime * 1e6 / updates << " us"; }
+	cout << "\n";
+	delete[] pairs;
 }
-// function used for enemy movement
-void Map::moveEnemies() {
-	for (int i = 0; i < numEnemies; i++) {
-		if (!enemies[i].seesUser) { // move randomly if user is not visible
-			int temp = rand() % 4;
-			// makes enemy wait a turn if it is unable to move to any spot around it
-			if (!canMove(enemies[i].vertex, 0) && !canMove(enemies[i].vertex, 1) && !canMove(enemies[i].vertex, 2) && !canMove(enemies[i].vertex, 3)) { temp = -1; }
-			else {
-				while (!canMove(enemies[i].vertex, temp)) { temp = rand() % 4; } // randomly pick a number from 0-3 until that number is a viable direction
-			}
-			if (temp == 0) { // up
-				if (enemies[i].tile == '-' && enemies[i].counter == 0) { enemies[i].counter++; } // grass takes additional step to move through
-				else {
-					map[enemies[i].vertex].symbol = enemies[i].tile;
-					enemies[i].vertex -= sqrt(numVertices);
-					enemies[i].tile = map[enemies[i].vertex].symbol;
-					map[enemies[i].vertex].symbol = '#';
-					enemies[i].counter = 0;
-				}
+
+// times loading, graph building and path queries for one map in every chase mode
+int RunBenchmarks(string filename, Settings& settings) {
+	const char* modeNames[] = { "dijkstra", "flow", "astar", "hpa", "incremental", "alt", "ch" };
+	// CHASE_INCREMENTAL keeps a search per enemy that only pays off while the enemy and the user move, so random pairs of
+	// tiles say nothing about it. --simulate --mode incremental measures it instead
+	const int NUM_BENCH_MODES = 6;
+	const ChaseMode modes[NUM_BENCH_MODES] = { CHASE_DIJKSTRA, CHASE_FLOW_FIELD, CHASE_ASTAR, CHASE_HIERARCHICAL, CHASE_LANDMARKS, CHASE_CONTRACTION };
+	const char* graphNames[] = { "grid", "csr" };
+	Instrumentation stats;
+	for (int graph = 0; graph < 2; graph++) {
+		Map map(1024);
+		ApplySettings(map, settings);
+		map.setGraphType((GraphType)graph);
+		auto start = chrono::steady_clock::now();
+		map.mapFromFile(filename);
+		double loadTime = ElapsedSeconds(start);
+		if (map.getNumVertices() == 0) {
+			cout << "Could not load " << filename << "\n";
+			return 1;
+		}
+		start = chrono::steady_clock::now();
+		map.mapToGraph();
+		double graphTime = ElapsedSeconds(start);
+		cout << filename << " [" << graphNames[graph] << "]: " << map.getNumVertices() << " tiles, mapFromFile " << loadTime * 1e3
+			<< " ms, mapToGraph " << graphTime * 1e3 << " ms\n";
+		if (graph == IMPLICIT_GRID) {
+			BenchOccupancy(map, settings);
+			BenchReachability(map, settings);
+		}
+
+		if (OpenTiles(map) == 0) {
+			cout << "  no tiles enemies can stand on, skipping the path queries\n";
+			continue;
+		}
+		int* sources = new int[settings.queries];
+		int* targets = new int[settings.queries];
+		unsigned int state = settings.seed ? settings.seed : 1;
+		RandomQueries(map, sources, targets, settings.queries, state);
+		double dijkstraTime = 0;
+		for (int m = 0; m < NUM_BENCH_MODES; m++) {
+			ChaseMode mode = modes[m];
+			map.setChaseMode(mode);
+			if (mode == CHASE_HIERARCHICAL) {
+				start = chrono::steady_clock::now();
+				map.buildHierarchy(settings.clusterSize);
+				cout << "  hpa build " << ElapsedSeconds(start) * 1e3 << " ms\n";
 			}
-			else if (temp == 1) { // down
-				if (enemies[i].tile == '-' && enemies[i].counter == 0) { enemies[i].counter++; }
-				else {
-					map[enemies[i].vertex].symbol = enemies[i].tile;
-					enemies[i].vertex += sqrt(numVertices);
-					enemies[i].tile = map[enemies[i].vertex].symbol;
-					map[enemies[i].vertex].symbol = '#';
-					enemies[i].counter = 0;
-				}
+			if (mode == CHASE_LANDMARKS) {
+				start = chrono::steady_clock::now();
+				if (map.getNumLandmarks() == 0 || settings.landmarks > 0) { map.buildLandmarks(settings.landmarks ? settings.landmarks : DEFAULT_LANDMARKS); }
+				cout << "  alt build " << ElapsedSeconds(start) * 1e3 << " ms, " << map.getNumLandmarks() << " landmarks, "
+					<< map.getLandmarkBytes() / 1048576.0 << " MB\n";
 			}
-			else if (temp == 2) { // left
-				if (enemies[i].tile == '-' && enemies[i].counter == 0) { enemies[i].counter++; }
-				else {
-					map[enemies[i].vertex].symbol = enemies[i].tile;
-					enemies[i].vertex -= 1;
-					enemies[i].tile = map[enemies[i].vertex].symbol;
-					map[enemies[i].vertex].symbol = '#';
-					enemies[i].counter = 0;
-				}
+			if (mode == CHASE_CONTRACTION) {
+				start = chrono::steady_clock::now();
+				map.buildContraction();
+				cout << "  ch build " << ElapsedSeconds(start) * 1e3 << " ms, " << map.getNumShortcuts() << " shortcuts, "
+					<< map.getContractionBytes() / 1048576.0 << " MB\n";
 			}
-			else if (temp == 3) { // right
-				if (enemies[i].tile == '-' && enemies[i].counter == 0) { enemies[i].counter++; }
-				else {
-					map[enemies[i].vertex].symbol = enemies[i].tile;
-					enemies[i].vertex += 1;
-					enemies[i].tile = map[enemies[i].vertex].symbol;
-					map[enemies[i].vertex].symbol = '#';
-					enemies[i].counter = 0;
+			long long settled = 0;
+			double queryTime = 0, probedTime = 0;
+			for (int pass = 0; pass < 4; pass++) { // alternates passes with and without instrumentation and keeps the best of each
+				map.setInstrumentation((pass % 2) ? &stats : nullptr);
+				settled = 0;
+				start = chrono::steady_clock::now();
+				for (int q = 0; q < settings.queries; q++) {
+					map.pathStep(sources[q], targets[q]);
+					settled += map.getSettled();
 				}
+				double elapsed = ElapsedSeconds(start);
+				double& best = (pass % 2) ? probedTime : queryTime;
+				if (pass < 2 || elapsed < best) { best = elapsed; }
 			}
+			map.setInstrumentation(nullptr);
+			cout << "  " << modeNames[mode] << ": " << queryTime * 1e6 / settings.queries << " us/query";
+			if (mode != CHASE_FLOW_FIELD && mode != CHASE_HIERARCHICAL) { cout << ", " << settled / settings.queries << " settled/query"; }
+			if (mode == CHASE_DIJKSTRA) { dijkstraTime = queryTime; }
+			else { cout << ", " << dijkstraTime / queryTime << "x dijkstra"; }
+			if (INSTRUMENTATION) { cout << ", instrumented " << (probedTime / queryTime - 1) * 100 << "%"; }
+			cout << "\n";
 		}
-		else { // if enemy can see the user, either move using Dijkstra or move onto user space
-			if (enemies[i].tile == '-' && enemies[i].counter == 0) { enemies[i].counter++; }
-			else if (!adjacentPlayer(enemies[i].vertex)) {
-				int next = Dijkstra(enemies[i].vertex, user.vertex);
-				if (map[next].symbol != '#') {
-					map[enemies[i].vertex].symbol = enemies[i].tile;
-					enemies[i].vertex = next;
-					enemies[i].tile = map[enemies[i].vertex].symbol;
-					map[next].symbol = '#';
-				}
-				enemies[i].counter = 0;
-			}
-			else {
-				map[enemies[i].vertex].symbol = enemies[i].tile;
-				enemies[i].tile = user.tile;
-				enemies[i].vertex = user.vertex;
-				map[enemies[i].vertex].symbol = '#';
-				int random = rand() % numHiddenTiles; // moves user to random hidden tile if caught
-				user.tile = 'H';
-				user.vertex = hiddenTiles[random];
-				map[hiddenTiles[random]].symbol = 'O';
-				enemies[i].counter = 0;
-				user.counter = 0;
-				cout << "You've been caught! Respawning at random hidden tile...";
-				for (int i = 0; i < numEnemies; i++) { // when caught, enemies no longer see user
-					enemies[i].seesUser = false;
-				}
-				_getch();
-				system("cls");
-				printMap();
+		delete[] sources;
+		delete[] targets;
+	}
+	if (!settings.stats.empty() && !stats.dump(settings.stats)) {
+		cout << "Could not write " << settings.stats << "\n";
+		return 1;
+	}
+	return 0;
+}
+// best of three passes of Dijkstra queries in microseconds per query, with whatever queue the map is set to
+double TimeDijkstra(Map& map, Settings& settings) {
+	int* sources = new int[settings.queries];
+	int* targets = new int[settings.queries];
+	unsigned int state = settings.seed ? settings.seed : 1;
+	RandomQueries(map, sources, targets, settings.queries, state);
+	double best = 0;
+	for (int pass = 0; pass < 3; pass++) {
+		auto start = chrono::steady_clock::now();
+		for (int q = 0; q < settings.queries; q++) { map.pathStep(sources[q], targets[q]); }
+		double elapsed = ElapsedSeconds(start);
+		if (pass == 0 || elapsed < best) { best = elapsed; }
+	}
+	delete[] sources;
+	delete[] targets;
+	return best * 1e6 / settings.queries;
+}
+// times Dijkstra with each frontier on generated maps of growing size and on any maps given, to find the size where the
+// dense array stops beating the queues. DENSE_MAX_VERTICES is set from its output.
+int RunCrossover(string* files, int numFiles, Settings& settings) {
+	const int sizes[] = { 8, 12, 16, 24, 28, 32, 40, 48, 64, 96, 128, 160 };
+	const char* types[] = { "open", "maze" };
+	SimdLevel best = SelectSimd(SIMD_AVX2);
+	cout << "tiles\tmap\theap\tbucket";
+	for (int level = SIMD_SCALAR; level <= best; level++) { cout << "\tdense " << SIMD_NAMES[level]; }
+	cout << "  (us/query)\n";
+	int crossover[2] = { 0, 0 };
+	for (int i = 0; i < 2 * 12 + numFiles; i++) {
+		string filename, name;
+		bool generated = i < 2 * 12;
+		if (generated) {
+			name = types[i / 12];
+			filename = "crossover_" + name + ".txt";
+			if (!GenerateMap(name, sizes[i % 12], sizes[i % 12], 0, settings.seed, filename)) { continue; }
+		}
+		else { filename = name = files[i - 2 * 12]; }
+		Map map(1024);
+		ApplySettings(map, settings);
+		map.setChaseMode(CHASE_DIJKSTRA);
+		map.mapFromFile(filename, !generated);
+		if (generated) { remove(filename.c_str()); }
+		if (map.getNumVertices() == 0) {
+			cout << "Could not load " << filename << "\n";
+			continue;
+		}
+		map.mapToGraph();
+		if (OpenTiles(map) == 0) {
+			cout << "No tiles enemies can stand on in " << filename << "\n";
+			continue;
+		}
+		double times[2 + 3];
+		for (int queue = BINARY_HEAP; queue <= BUCKET_QUEUE; queue++) {
+			map.setQueueType((QueueType)queue);
+			times[queue] = TimeDijkstra(map, settings);
+		}
+		map.setQueueType(DENSE_ARRAY);
+		for (int level = SIMD_SCALAR; level <= best; level++) {
+			SelectSimd((SimdLevel)level);
+			times[2 + level] = TimeDijkstra(map, settings);
+		}
+		SelectSimd(best);
+		cout << map.getNumVertices() << "\t" << name;
+		for (int k = 0; k < 3 + best; k++) { cout << "\t" << times[k]; }
+		cout << "\n" << flush;
+		if (generated && times[2 + best] < min(times[BINARY_HEAP], times[BUCKET_QUEUE])) { crossover[i / 12] = map.getNumVertices(); }
+	}
+	if (crossover[0] == 0 && crossover[1] == 0) { cout << "dense " << SIMD_NAMES[best] << " never beat both queues"; }
+	else { cout << "dense " << SIMD_NAMES[best] << " is fastest up to " << crossover[0] << " tiles on open maps and " << crossover[1] << " on mazes"; }
+	cout << ", DENSE_MAX_VERTICES is " << DENSE_MAX_VERTICES << "\n";
+	return 0;
+}
+// converts a text map into the compiled format, with its adjacency when --graph csr is given and landmarks with --landmarks
+int CompileMap(string filename, string output, Settings& settings) {
+	Map map(1024);
+	ApplySettings(map, settings);
+	map.mapFromFile(filename, false);
+	if (map.getNumVertices() == 0) {
+		cout << "Could not load " << filename << "\n";
+		return 1;
+	}
+	map.mapToGraph();
+	if (settings.landmarks > 0) { map.buildLandmarks(settings.landmarks); }
+	if (output.empty()) { output = CompiledName(filename); }
+	if (!map.saveCompiled(output)) {
+		cout << "Could not write " << output << "\n";
+		return 1;
+	}
+	cout << filename << " -> " << output << "\n";
+	return 0;
+}
+
+// chunked worlds: terrain packed like Map::terrain but cut into CHUNK_SIZE square chunks, stored one after another in
+// row-major chunk order after the header so any chunk can be read on its own
+const int CHUNK_SIZE = 64; // chunks are this many tiles wide and high
+const int CHUNK_BYTES = CHUNK_SIZE * CHUNK_SIZE / 4;
+const int WORLD_FILE_VERSION = 1;
+const int DEFAULT_CHUNK_SLOTS = 256; // chunks --world keeps in memory at once
+const int WORLD_SEARCH_LIMIT = 8192; // tiles an enemy's search settles before it gives up and waits for the next turn
+const int WORLD_ACTIVE_RADIUS = 32; // enemies this close to the player chase it, the rest are left alone and their chunks age out
+const int WORLD_REPLAN_DISTANCE = 4; // an enemy keeps following its path until the player is this far from where it ends
+const int WORLD_PREFETCH_STEPS = 64; // steps of a planned path whose chunks are read ahead of the enemy
+
+struct WorldFileHeader {
+	char magic[4]; // "WRLD"
+	int version;
+	int width; // multiples of CHUNK_SIZE
+	int height;
+	int chunkSize;
+	int player; // tile the player starts on
+};
+
+class ChunkedWorld { // world read from a chunked file a chunk at a time, the chunks in use are held in a fixed number of slots and
+private:             // the least recently used one is replaced when a tile in a chunk that is not held is read
+	ifstream file;
+	int width;
+	int height;
+	int chunksWide;
+	int* chunkSlot; // slot holding each chunk, -1 if it is only on disk
+	unsigned char* slotTiles; // CHUNK_BYTES per slot
+	int* slotChunk; // chunk in each slot, -1 if the slot is empty
+	int* slotPrev; // slots from the most recently used (head) to the least (tail)
+	int* slotNext;
+	int numSlots;
+	int head;
+	int tail;
+	int lastChunk; // reads usually stay in one chunk, so the list is only reordered when they move to another
+	int lastSlot;
+	void touch(int slot);
+	int load(int chunk);
+	int chunkOf(int tile) { return (tile / width / CHUNK_SIZE) * chunksWide + (tile % width) / CHUNK_SIZE; }
+public:
+	int player;
+	long long pageIns; // chunks read because a tile in them was needed
+	long long prefetches; // chunks read ahead of time
+	long long evictions;
+	ChunkedWorld() {
+		width = 0;
+		height = 0;
+		chunksWide = 0;
+		chunkSlot = nullptr;
+		slotTiles = nullptr;
+		slotChunk = nullptr;
+		slotPrev = nullptr;
+		slotNext = nullptr;
+		numSlots = 0;
+		head = -1;
+		tail = -1;
+		lastChunk = -1;
+		lastSlot = -1;
+		player = 0;
+		pageIns = 0;
+		prefetches = 0;
+		evictions = 0;
+	}
+	~ChunkedWorld() {
+		delete[] chunkSlot;
+		delete[] slotTiles;
+		delete[] slotChunk;
+		delete[] slotPrev;
+		delete[] slotNext;
+	}
+	bool open(string filename, int slots);
+	int terrainAt(int tile);
+	void prefetch(int tile); // reads the tile's chunk if it is not held and marks it as just used
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+	int getNumChunks() { return chunksWide * (height / CHUNK_SIZE); }
+	int getNumSlots() { return numSlots; }
+};
+
+class WorldSearch { // A* scratch for a ChunkedWorld. The tiles a search reaches go in a hash table sized by WORLD_SEARCH_LIMIT,
+public:             // the world is too big for arrays with a slot per tile like SearchContext's
+	int* tiles;
+	int* dist;
+	int* prev;
+	unsigned int* stamp; // a slot is in use where stamp >= epoch and its tile is settled where stamp == epoch + 1
+	int capacity; // power of two, more than twice the tiles a search can reach
+	unsigned int epoch;
+	BinaryHeap heap;
+	WorldSearch() {
+		capacity = 1;
+		while (capacity < 8 * WORLD_SEARCH_LIMIT + 8) { capacity *= 2; }
+		tiles = new int[capacity];
+		dist = new int[capacity];
+		prev = new int[capacity];
+		stamp = new unsigned int[capacity]();
+		epoch = 0;
+	}
+	~WorldSearch() {
+		delete[] tiles;
+		delete[] dist;
+		delete[] prev;
+		delete[] stamp;
+	}
+	void begin();
+	int slotOf(int tile); // claims a slot for the tile the first time it is reached in this search
+};
+
+bool ChunkedWorld::open(string filename, int slots) {
+	file.open(filename, ios::binary);
+	WorldFileHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, "WRLD", 4) != 0 || header.version != WORLD_FILE_VERSION
+		|| header.chunkSize != CHUNK_SIZE || header.width < CHUNK_SIZE || header.height < CHUNK_SIZE || header.width % CHUNK_SIZE != 0
+		|| header.height % CHUNK_SIZE != 0 || (long long)header.width * header.height > INT_MAX || header.player < 0
+		|| header.player >= header.width * header.height) { return false; }
+	width = header.width;
+	height = header.height;
+	chunksWide = width / CHUNK_SIZE;
+	player = header.player;
+	chunkSlot = new int[getNumChunks()];
+	for (int i = 0; i < getNumChunks(); i++) { chunkSlot[i] = -1; }
+	numSlots = max(1, min(slots, getNumChunks()));
+	slotTiles = new unsigned char[(size_t)numSlots * CHUNK_BYTES];
+	slotChunk = new int[numSlots];
+	slotPrev = new int[numSlots];
+	slotNext = new int[numSlots];
+	for (int i = 0; i < numSlots; i++) {
+		slotChunk[i] = -1;
+		slotPrev[i] = i - 1;
+		slotNext[i] = (i + 1 < numSlots) ? i + 1 : -1;
+	}
+	head = 0;
+	tail = numSlots - 1;
+	return true;
+}
+
+void ChunkedWorld::touch(int slot) {
+	if (slot == head) { return; }
+	slotNext[slotPrev[slot]] = slotNext[slot]; // unlinks the slot, it has a previous one since it is not the head
+	if (slot == tail) { tail = slotPrev[slot]; }
+	else { slotPrev[slotNext[slot]] = slotPrev[slot]; }
+	slotPrev[slot] = -1;
+	slotNext[slot] = head;
+	slotPrev[head] = slot;
+	head = slot;
+}
+// reads the chunk into the least recently used slot
+int ChunkedWorld::load(int chunk) {
+	int slot = tail;
+	if (slotChunk[slot] >= 0) {
+		chunkSlot[slotChunk[slot]] = -1;
+		evictions++;
+	}
+	if (slot == lastSlot) { lastChunk = -1; }
+	file.clear();
+	file.seekg((streamoff)sizeof(WorldFileHeader) + (streamoff)chunk * CHUNK_BYTES);
+	if (!file.read((char*)slotTiles + (size_t)slot * CHUNK_BYTES, CHUNK_BYTES)) { memset(slotTiles + (size_t)slot * CHUNK_BYTES, 0, CHUNK_BYTES); } // walls
+	slotChunk[slot] = chunk;
+	chunkSlot[chunk] = slot;
+	touch(slot);
+	return slot;
+}
+
+int ChunkedWorld::terrainAt(int tile) {
+	int chunk = chunkOf(tile);
+	if (chunk != lastChunk) {
+		int slot = chunkSlot[chunk];
+		if (slot < 0) {
+			slot = load(chunk);
+			pageIns++;
+		}
+		else { touch(slot); }
+		lastChunk = chunk;
+		lastSlot = slot;
+	}
+	int local = (tile / width % CHUNK_SIZE) * CHUNK_SIZE + tile % width % CHUNK_SIZE;
+	return TerrainAt(slotTiles + (size_t)lastSlot * CHUNK_BYTES, local);
+}
+
+void ChunkedWorld::prefetch(int tile) {
+	int chunk = chunkOf(tile);
+	if (chunkSlot[chunk] >= 0) { touch(chunkSlot[chunk]); }
+	else {
+		load(chunk);
+		prefetches++;
+	}
+}
+
+void WorldSearch::begin() {
+	if (epoch >= UINT_MAX - 2) {
+		for (int i = 0; i < capacity; i++) { stamp[i] = 0; }
+		epoch = 0;
+	}
+	epoch += 2;
+	heap.clear();
+}
+
+int WorldSearch::slotOf(int tile) {
+	int slot = (int)(((unsigned int)tile * 0x9E3779B1u) >> 7) & (capacity - 1);
+	while (stamp[slot] >= epoch && tiles[slot] != tile) { slot = (slot + 1) & (capacity - 1); } // linear probing
+	if (stamp[slot] < epoch) {
+		tiles[slot] = tile;
+		dist[slot] = INT_MAX;
+		stamp[slot] = epoch;
+	}
+	return slot;
+}
+// A* from source to target with the enemy rules, faulting chunks in as it reaches them. Writes the path into path, source
+// first, and returns its length, 0 if the target was not found within WORLD_SEARCH_LIMIT settled tiles.
+int FindWorldPath(ChunkedWorld& world, WorldSearch& search, int source, int target, int*& path, int& pathSize) {
+	int width = world.getWidth(), numTiles = width * world.getHeight();
+	int tx = target % width, ty = target / width;
+	search.begin();
+	int s = search.slotOf(source);
+	search.dist[s] = 0;
+	search.prev[s] = -1;
+	search.heap.push(source, 0);
+	int count = 0;
+	bool found = false;
+	while (!search.heap.empty() && count < WORLD_SEARCH_LIMIT) {
+		int u = search.heap.pop();
+		int su = search.slotOf(u);
+		if (search.stamp[su] == search.epoch + 1) { continue; }
+		search.stamp[su] = search.epoch + 1;
+		count++;
+		if (u == target) {
+			found = true;
+			break;
+		}
+		int column = u % width;
+		int next[4] = { column > 0 ? u - 1 : -1, column < width - 1 ? u + 1 : -1, u - width, u + width };
+		for (int i = 0; i < 4; i++) {
+			int v = next[i];
+			if (v < 0 || v >= numTiles) { continue; }
+			int code = world.terrainAt(v);
+			if (TERRAIN_WEIGHTS[code] == 0 || (!Enters<EnemyRules>(code) && v != target)) { continue; }
+			int sv = search.slotOf(v);
+			int alt = search.dist[su] + TERRAIN_WEIGHTS[code];
+			if (search.stamp[sv] != search.epoch + 1 && alt < search.dist[sv]) {
+				search.dist[sv] = alt;
+				search.prev[sv] = u;
+				search.heap.push(v, alt + abs(v % width - tx) + abs(v / width - ty)); // Manhattan distance, plain tiles cost 1
 			}
 		}
 	}
-	setVisibility();
+	if (!found) { return 0; }
+	int length = 1;
+	for (int v = target; v != source; v = search.prev[search.slotOf(v)]) { length++; }
+	if (length > pathSize) {
+		delete[] path;
+		pathSize = length;
+		path = new int[pathSize];
+	}
+	for (int v = target, i = length - 1; i >= 0; i--) {
+		path[i] = v;
+		if (i > 0) { v = search.prev[search.slotOf(v)]; }
+	}
+	return length;
+}
+// writes a random world one chunk at a time, each chunk from its own random stream, so worlds larger than memory can be made
+bool GenerateWorld(int width, int height, unsigned int seed, string filename) {
+	width = (width + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+	height = (height + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+	if (width < CHUNK_SIZE || height < CHUNK_SIZE || (long long)width * height > INT_MAX) { return false; }
+	ofstream outFS(filename, ios::binary);
+	if (!outFS.is_open()) { return false; }
+	WorldFileHeader header;
+	memcpy(header.magic, "WRLD", 4);
+	header.version = WORLD_FILE_VERSION;
+	header.width = width;
+	header.height = height;
+	header.chunkSize = CHUNK_SIZE;
+	header.player = (height / 2) * width + width / 2;
+	outFS.write((const char*)&header, sizeof(header));
+	unsigned char chunk[CHUNK_BYTES];
+	int chunksWide = width / CHUNK_SIZE, chunksHigh = height / CHUNK_SIZE;
+	for (int c = 0; c < chunksWide * chunksHigh; c++) {
+		unsigned int state = (seed ? seed : 1) * 0x9E3779B1u + (unsigned int)c * 0x85EBCA77u;
+		if (state == 0) { state = 1; }
+		memset(chunk, 0, CHUNK_BYTES);
+		for (int local = 0; local < CHUNK_SIZE * CHUNK_SIZE; local++) {
+			int x = (c % chunksWide) * CHUNK_SIZE + local % CHUNK_SIZE, y = (c / chunksWide) * CHUNK_SIZE + local / CHUNK_SIZE;
+			int roll = NextRandom(state) % 100; // the same mix as an open map
+			int code = (roll < 8) ? TERRAIN_WALL : (roll < 18) ? TERRAIN_GRASS : (roll < 19) ? TERRAIN_HIDDEN : TERRAIN_PLAIN;
+			if (x == 0 || y == 0 || x == width - 1 || y == height - 1) { code = TERRAIN_WALL; }
+			if (y * width + x == header.player) { code = TERRAIN_PLAIN; }
+			chunk[local >> 2] |= (unsigned char)(code << ((local & 3) * 2));
+		}
+		outFS.write((const char*)chunk, CHUNK_BYTES);
+	}
+	return outFS.good();
 }
 
-void Map::move(char direction) { // main movement function since user moves before enemies
-	int n;
-	direction = tolower(direction);
-	if (direction == 'w' || direction == 'W') { n = 0; } // checks for valid direction
-	else if (direction == 's' || direction == 'S') { n = 1; }
-	else if (direction == 'a' || direction == 'A') { n = 2; }
-	else if (direction == 'd' || direction == 'D') { n = 3; }
-	else { n = -1; }
-	if (n >= 0) {
-		if (canMove(user.vertex, n) || adjacentHidden(user.vertex, n)) { // player can move where enemies can but also to hidden tiles
-			if (n == 0) { // up
-				if (user.tile == '-' && user.counter == 0) { user.counter++; } // grass takes additional step to move through
-				else {
-					map[user.vertex].symbol = user.tile;
-					user.vertex -= sqrt(numVertices);
-					user.tile = map[user.vertex].symbol;
-					map[user.vertex].symbol = 'O';
-					user.counter = 0;
-				}
+long long PeakResidentBytes() { // largest the process has been in memory so far, 0 if the OS does not say
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return (long long)counters.PeakWorkingSetSize; }
+	return 0;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+#ifdef __APPLE__
+	return usage.ru_maxrss; // bytes on macOS
+#else
+	return usage.ru_maxrss * 1024LL; // kilobytes elsewhere
+#endif
+#endif
+}
+
+struct WorldEnemy {
+	int tile;
+	int counter; // grass takes additional step to move through
+	int* path; // planned path, path[step] is where the enemy stands
+	int pathLength; // 0 if there is no plan
+	int pathSize;
+	int step;
+};
+// places an enemy on a free tile about WORLD_ACTIVE_RADIUS from the player, as if it had just wandered into range
+void SpawnWorldEnemy(ChunkedWorld& world, WorldEnemy* enemies, int numEnemies, int enemy, int playerTile, unsigned int& state) {
+	int width = world.getWidth(), height = world.getHeight();
+	int px = playerTile % width, py = playerTile / width;
+	for (int attempt = 0; attempt < 64; attempt++) {
+		int dx = (int)(NextRandom(state) % (2 * WORLD_ACTIVE_RADIUS + 1)) - WORLD_ACTIVE_RADIUS;
+		int dy = WORLD_ACTIVE_RADIUS - abs(dx);
+		if (NextRandom(state) % 2) { dy = -dy; }
+		int x = px + dx, y = py + dy;
+		if (x < 0 || y < 0 || x >= width || y >= height) { continue; }
+		int tile = y * width + x;
+		if (!Enters<EnemyRules>(world.terrainAt(tile))) { continue; }
+		bool taken = false;
+		for (int i = 0; i < numEnemies && !taken; i++) { taken = (i != enemy && enemies[i].tile == tile); }
+		if (taken) { continue; }
+		enemies[enemy].tile = tile;
+		break;
+	}
+	enemies[enemy].counter = 0;
+	enemies[enemy].pathLength = 0;
+}
+// walks the player across a chunked world with enemies chasing it and reports how the chunk cache coped. The player keeps a
+// heading for a while so it actually travels, and only the enemies near it move, so the chunks in use follow the player.
+int RunWorld(string filename, Settings& settings) {
+	ChunkedWorld world;
+	if (!world.open(filename, settings.chunks)) {
+		cout << "Could not load " << filename << "\n";
+		return 1;
+	}
+	int width = world.getWidth(), numTiles = width * world.getHeight();
+	unsigned int state = settings.seed ? settings.seed : 1;
+	int playerTile = world.player, playerCounter = 0, heading = 0;
+	int numEnemies = (settings.enemies > 0) ? settings.enemies : 0;
+	WorldEnemy* enemies = new WorldEnemy[numEnemies > 0 ? numEnemies : 1];
+	for (int i = 0; i < numEnemies; i++) {
+		enemies[i].tile = -1;
+		enemies[i].path = nullptr;
+		enemies[i].pathSize = 0;
+		SpawnWorldEnemy(world, enemies, numEnemies, i, playerTile, state);
+	}
+	WorldSearch search;
+	string moves = ReadMoves(settings.script);
+	const int offsets[4] = { -width, width, -1, 1 }; // up, down, left, right
+	auto playerStep = [&](int direction) { // tile the player would move onto, -1 if it cannot
+		int next = playerTile + offsets[direction];
+		bool open = next >= 0 && next < numTiles && (direction < 2 || next / width == playerTile / width) && Enters<PlayerRules>(world.terrainAt(next));
+		return open ? next : -1;
+	};
+	long long searches = 0, caught = 0;
+	double* latencies = new double[settings.turns];
+	auto start = chrono::steady_clock::now();
+	for (int t = 0; t < settings.turns; t++) {
+		auto turnStart = chrono::steady_clock::now();
+		int direction = heading;
+		if (!moves.empty()) {
+			char key = moves[t % moves.size()];
+			direction = (key == 'w') ? 0 : (key == 's') ? 1 : (key == 'a') ? 2 : (key == 'd') ? 3 : -1;
+		}
+		if (direction >= 0) {
+			int next = playerStep(direction);
+			if (next < 0 && moves.empty()) { next = playerStep((direction < 2 ? 2 : 0) + NextRandom(state) % 2); } // sidesteps what is in the way
+			if (moves.empty() && (next < 0 || NextRandom(state) % 256 == 0)) { heading = NextRandom(state) % 4; } // turns when stuck and now and then
+			if (next >= 0 && HasRule(SLOW_TERRAIN, world.terrainAt(playerTile)) && playerCounter == 0) { playerCounter++; }
+			else if (next >= 0) {
+				playerTile = next;
+				playerCounter = 0;
 			}
-			else if (n == 1) { // down
-				if (user.tile == '-' && user.counter == 0) { user.counter++; }
-				else {
-					map[user.vertex].symbol = user.tile;
-					user.vertex += sqrt(numVertices);
-					user.tile = map[user.vertex].symbol;
-					map[user.vertex].symbol = 'O';
-					user.counter = 0;
-				}
+		}
+		int px = playerTile % width, py = playerTile / width;
+		for (int dy = -1; dy <= 1; dy++) { // keeps the chunks around the player warm
+			for (int dx = -1; dx <= 1; dx++) {
+				int x = px + dx * CHUNK_SIZE, y = py + dy * CHUNK_SIZE;
+				if (x >= 0 && y >= 0 && x < width && y < world.getHeight()) { world.prefetch(y * width + x); }
 			}
-			else if (n == 2) { // left
-				if (user.tile == '-' && user.counter == 0) { user.counter++; }
-				else {
-					map[user.vertex].symbol = user.tile;
-					user.vertex -= 1;
-					user.tile = map[user.vertex].symbol;
-					map[user.vertex].symbol = 'O';
-					user.counter = 0;
-				}
+		}
+		for (int i = 0; i < numEnemies; i++) {
+			WorldEnemy& e = enemies[i];
+			int distance = abs(e.tile % width - px) + abs(e.tile / width - py);
+			if (e.tile < 0 || distance > 4 * WORLD_ACTIVE_RADIUS) { // left behind, replaced by one near the player
+				SpawnWorldEnemy(world, enemies, numEnemies, i, playerTile, state);
+				continue;
 			}
-			else { // right
-				if (user.tile == '-' && user.counter == 0) { user.counter++; }
-				else {
-					map[user.vertex].symbol = user.tile;
-					user.vertex += 1;
-					user.tile = map[user.vertex].symbol;
-					map[user.vertex].symbol = 'O';
-					user.counter = 0;
-				}
+			if (distance > WORLD_ACTIVE_RADIUS || HasRule(HIDING_TERRAIN, world.terrainAt(playerTile))) { continue; }
+			if (distance <= 1) {
+				caught++;
+				SpawnWorldEnemy(world, enemies, numEnemies, i, playerTile, state);
+				continue;
 			}
-			if (user.tile == 'H') { // enemies lose sight of user if user is on hidden tile
-				for (int i = 0; i < numEnemies; i++) {
-					enemies[i].seesUser = false;
+			if (HasRule(SLOW_TERRAIN, world.terrainAt(e.tile)) && e.counter == 0) {
+				e.counter++;
+				continue;
+			}
+			int end = (e.pathLength > 0) ? e.path[e.pathLength - 1] : -1;
+			if (e.pathLength == 0 || e.step + 1 >= e.pathLength || abs(end % width - px) + abs(end / width - py) > WORLD_REPLAN_DISTANCE) {
+				e.pathLength = FindWorldPath(world, search, e.tile, playerTile, e.path, e.pathSize);
+				e.step = 0;
+				searches++;
+			}
+			if (e.pathLength == 0) { continue; }
+			int next = e.path[e.step + 1];
+			bool taken = (next == playerTile);
+			for (int j = 0; j < numEnemies && !taken; j++) { taken = (enemies[j].tile == next); }
+			if (!taken) {
+				e.tile = next;
+				e.step++;
+				e.counter = 0;
+			}
+			int lastChunkTile = -1; // reads the chunks the rest of the path crosses before the enemy gets there
+			for (int s = e.step; s < e.pathLength && s <= e.step + WORLD_PREFETCH_STEPS; s++) {
+				int tile = e.path[s];
+				if (lastChunkTile < 0 || tile / width / CHUNK_SIZE != lastChunkTile / width / CHUNK_SIZE || tile % width / CHUNK_SIZE != lastChunkTile % width / CHUNK_SIZE) {
+					world.prefetch(tile);
+					lastChunkTile = tile;
 				}
 			}
-			moveEnemies(); // enemies move after user
 		}
+		latencies[t] = ElapsedSeconds(turnStart) * 1e6;
 	}
-	setVisibility(); // after all movement, check if enemies can see user
+	double total = ElapsedSeconds(start);
+	sort(latencies, latencies + settings.turns);
+	cout << filename << ": " << width << "x" << world.getHeight() << " tiles in " << world.getNumChunks() << " chunks of " << CHUNK_SIZE << "x" << CHUNK_SIZE
+		<< ", " << world.getNumSlots() << " held (" << (long long)world.getNumSlots() * CHUNK_BYTES / 1024 << " KB), " << numEnemies << " enemies, " << settings.turns << " turns\n";
+	cout << "turns/sec " << settings.turns / total << "\n";
+	cout << "latency us  p50 " << latencies[settings.turns / 2] << "  p90 " << latencies[settings.turns * 9 / 10]
+		<< "  p99 " << latencies[settings.turns * 99 / 100] << "  max " << latencies[settings.turns - 1] << "\n";
+	cout << "chunk page-ins " << world.pageIns << "  prefetched " << world.prefetches << "  evicted " << world.evictions << "\n";
+	int travelled = abs(playerTile % width - world.player % width) + abs(playerTile / width - world.player / width);
+	cout << "searches " << searches << "  caught " << caught << "  player ended " << travelled << " tiles from its start\n";
+	cout << "peak RSS " << PeakResidentBytes() / 1024 << " KB\n";
+	for (int i = 0; i < numEnemies; i++) { delete[] enemies[i].path; }
+	delete[] enemies;
+	delete[] latencies;
+	return 0;
 }
-// acts as a destructor then constructor to reset instance of Map to allow for current map to be overwritten
-void Map::reset() {
-	for (int i = 0; i < mapSize; i++) {
-		Tile* current = list[i];
-		while (current) {
-			Tile* next = current->next;
-			delete current;
-			current = next;
+
+const int HOST_MAX_MAPS = 64; // different map files one host keeps loaded for its sessions
+
+struct HostClient { // where the replies to one input stream go, each reply is written whole so shards can answer at once
+	int fd; // socket, -1 for stdout
+	mutex lock;
+	atomic<int> pending; // commands handed to shards that have not been answered yet
+	HostClient(int value) : fd(value), pending(0) {}
+};
+
+enum HostAction { HOST_OPEN, HOST_MOVE, HOST_RUN, HOST_CLOSE };
+
+struct HostCommand {
+	HostAction action;
+	int session;
+	int turns; // random turns every session of the shard takes for HOST_RUN
+	string keys; // moves for HOST_MOVE, '.' waits a turn
+	Map* base; // map a HOST_OPEN session shares
+	HostClient* client;
+};
+
+struct HostSession { // one game played by a shard
+	Map* map; // nullptr once the session is closed
+	unsigned int random; // state of the moves made for it by HOST_RUN
+	long long turns;
+};
+
+void HostReply(HostClient& client, string line) {
+	line += "\n";
+	lock_guard<mutex> guard(client.lock);
+	if (client.fd < 0) {
+		cout << line << flush;
+		return;
+	}
+#ifndef _WIN32
+	for (size_t sent = 0; sent < line.size();) {
+		ssize_t n = write(client.fd, line.data() + sent, line.size() - sent);
+		if (n <= 0) { return; } // the client went away, its remaining replies are dropped
+		sent += n;
+	}
+#endif
+}
+// runs many independent games side by side. Sessions are sharded over a fixed set of worker threads by id, and each
+// shard owns its sessions outright, so a turn never waits for a lock another shard holds: the only lock a shard takes is
+// its own inbox's, to pick up the commands queued for it. Sessions opened on the same map file all read one copy of its
+// terrain and search structures, see Map::shareFrom.
+class SessionHost {
+private:
+	struct Shard {
+		thread worker;
+		mutex lock; // guards the inbox and stopping
+		condition_variable ready;
+		HostCommand* inbox;
+		int inboxCount;
+		int inboxSize;
+		bool stopping;
+		HostSession* sessions; // session id / numShards
+		int sessionsSize;
+		atomic<long long> turns;
+		atomic<int> open;
+	};
+	Shard* shards;
+	int numShards;
+	Settings settings;
+	mutex basesLock; // only taken to open sessions
+	Map* bases[HOST_MAX_MAPS]; // loaded once per map file and never changed, the sessions read from them
+	string baseNames[HOST_MAX_MAPS];
+	int numBases;
+	atomic<int> nextSession;
+	chrono::steady_clock::time_point start;
+	Map* loadBase(string filename);
+	void post(int shard, HostCommand& command);
+	void work(int index);
+	void execute(Shard& shard, HostCommand& command);
+	HostSession* find(Shard& shard, int session);
+public:
+	SessionHost(int count, Settings& value);
+	~SessionHost();
+	bool handle(string line, HostClient& client); // runs one protocol line, false once the client asked to quit
+	void sync(HostClient& client); // waits until every command the client sent has been answered
+	long long getTurns();
+	int getSessions();
+	double getSeconds();
+	int size() { return numShards; }
+};
+
+SessionHost::SessionHost(int count, Settings& value) {
+	numShards = (count < 1) ? 1 : count;
+	settings = value;
+	numBases = 0;
+	nextSession = 0;
+	start = chrono::steady_clock::now();
+	shards = new Shard[numShards];
+	for (int i = 0; i < numShards; i++) {
+		shards[i].inbox = nullptr;
+		shards[i].inboxCount = 0;
+		shards[i].inboxSize = 0;
+		shards[i].stopping = false;
+		shards[i].sessions = nullptr;
+		shards[i].sessionsSize = 0;
+		shards[i].turns = 0;
+		shards[i].open = 0;
+	}
+	for (int i = 0; i < numShards; i++) { shards[i].worker = thread(&SessionHost::work, this, i); }
+}
+
+SessionHost::~SessionHost() { // shards finish whatever is queued before they stop
+	for (int i = 0; i < numShards; i++) {
+		{
+			lock_guard<mutex> guard(shards[i].lock);
+			shards[i].stopping = true;
 		}
+		shards[i].ready.notify_one();
 	}
-	delete[] list;
-	delete[] current;
-	delete[] map;
-	delete[] enemies;
+	for (int i = 0; i < numShards; i++) {
+		shards[i].worker.join();
+		for (int j = 0; j < shards[i].sessionsSize; j++) { delete shards[i].sessions[j].map; }
+		delete[] shards[i].sessions;
+		delete[] shards[i].inbox;
+	}
+	delete[] shards;
+	for (int i = 0; i < numBases; i++) { delete bases[i]; }
+}
 
-	numVertices = 0;
-	list = new Tile * [mapSize];
-	current = new Tile * [mapSize];
-	map = new Tile[mapSize];
-	for (int u = 0; u < mapSize; u++) {
-		list[u] = nullptr;
-		current[u] = nullptr;
+Map* SessionHost::loadBase(string filename) {
+	lock_guard<mutex> guard(basesLock);
+	for (int i = 0; i < numBases; i++) {
+		if (baseNames[i] == filename) { return bases[i]; }
 	}
-	numEnemies = 0;
-	enemies = new Characters[enemiesSize];
-	numHiddenTiles = 0;
-	hiddenTiles = new int[hiddenSize];
+	if (numBases == HOST_MAX_MAPS) { return nullptr; }
+	Map* base = new Map(1024);
+	ApplySettings(*base, settings);
+	base->setThreads(0); // never takes a turn itself
+	base->mapFromFile(filename);
+	if (base->getNumVertices() == 0) {
+		delete base;
+		return nullptr;
+	}
+	base->mapToGraph();
+	if (settings.mode == CHASE_HIERARCHICAL) { base->buildHierarchy(settings.clusterSize); }
+	if (settings.mode == CHASE_LANDMARKS && base->getNumLandmarks() == 0) { base->buildLandmarks(settings.landmarks ? settings.landmarks : DEFAULT_LANDMARKS); }
+	base->prepareSharing();
+	baseNames[numBases] = filename;
+	bases[numBases++] = base;
+	return base;
 }
-// function to print main menu
-void PrintMenu() {
-	cout << "\n\n";
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 9);
-	cout << "       _____  _ _ _        _             _        _____ _                _            _     _____      _   _     " << endl;
-	cout << "      |  __ \\(_|_) |      | |           ( )      / ____| |              | |          | |   |  __ \\    | | | |    " << endl;
-	cout << "      | |  | |_ _| | _____| |_ _ __ __ _|/ ___  | (___ | |__   ___  _ __| |_ ___  ___| |_  | |__) |_ _| |_| |__  " << endl;
-	cout << "      | |  | | | | |/ / __| __| '__/ _` | / __|  \\___ \\| '_ \\ / _ \\| '__| __/ _ \\/ __| __| |  ___/ _` | __| '_ \\ " << endl;
-	cout << "      | |__| | | |   <\\__ \\ |_| | | (_| | \\__ \\  ____) | | | | (_) | |  | ||  __/\\__ \\ |_  | |  | (_| | |_| | | |" << endl;
-	cout << "      |_____/|_| |_|\\_\\___/\\__|_|  \\__,_| |___/ |_____/|_| |_|\\___/|_|   \\__\\___||___/\\__| |_|   \\__,_|\\__|_| |_|" << endl;
-	cout << "              _/ |                                                                                               " << endl;
-	cout << "             |__/" << endl;
-	cout << "  __-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__-__";
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 7);
-	cout << "\n\n\n\n\t\t\t\t\t\t     MAIN MENU\n\n";
-	cout << "\t\t\t\t\t\tw. Start/continue game\n";
-	cout << "\t\t\t\t\t\ta. View example map\n";
-	cout << "\t\t\t\t\t\ts. Controls and info\n";
-	cout << "\t\t\t\t\t\td. Reset\n";
-	cout << "\t\t\t\t\t\tq. Quit game\n";
-	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 15);
+
+void SessionHost::post(int shard, HostCommand& command) {
+	command.client->pending++;
+	Shard& target = shards[shard];
+	{
+		lock_guard<mutex> guard(target.lock);
+		if (target.inboxCount == target.inboxSize) {
+			target.inboxSize = (target.inboxSize == 0) ? 16 : target.inboxSize * 2;
+			HostCommand* temp = new HostCommand[target.inboxSize];
+			for (int i = 0; i < target.inboxCount; i++) { temp[i] = target.inbox[i]; }
+			delete[] target.inbox;
+			target.inbox = temp;
+		}
+		target.inbox[target.inboxCount++] = command;
+	}
+	target.ready.notify_one();
+}
+// takes the whole inbox at once and runs it with the lock released, so posting never waits for a turn
+void SessionHost::work(int index) {
+	Shard& shard = shards[index];
+	HostCommand* taken = nullptr;
+	int takenSize = 0;
+	while (true) {
+		int count;
+		{
+			unique_lock<mutex> guard(shard.lock);
+			shard.ready.wait(guard, [&shard] { return shard.stopping || shard.inboxCount > 0; });
+			if (shard.inboxCount == 0) { break; } // stopping with nothing left to do
+			swap(taken, shard.inbox);
+			swap(takenSize, shard.inboxSize);
+			count = shard.inboxCount;
+			shard.inboxCount = 0;
+		}
+		for (int i = 0; i < count; i++) {
+			execute(shard, taken[i]);
+			taken[i].client->pending--;
+			taken[i].keys.clear();
+		}
+	}
+	delete[] taken;
 }
 
-char GetInput() { // gets user input using getch, accounts for capitalization
-	cout << "\n\n\t\t\t\t\t\tEnter choice:";
-	char temp = _getch();
-	temp = tolower(temp);
-	return temp;
+HostSession* SessionHost::find(Shard& shard, int session) {
+	int local = session / numShards;
+	if (session < 0 || local >= shard.sessionsSize || !shard.sessions[local].map) { return nullptr; }
+	return &shard.sessions[local];
+}
+
+void SessionHost::execute(Shard& shard, HostCommand& command) {
+	if (command.action == HOST_OPEN) {
+		int local = command.session / numShards;
+		if (local >= shard.sessionsSize) {
+			int size = (shard.sessionsSize == 0) ? 16 : shard.sessionsSize;
+			while (size <= local) { size *= 2; }
+			HostSession* temp = new HostSession[size];
+			for (int i = 0; i < size; i++) { temp[i] = (i < shard.sessionsSize) ? shard.sessions[i] : HostSession{ nullptr, 0, 0 }; }
+			delete[] shard.sessions;
+			shard.sessions = temp;
+			shard.sessionsSize = size;
+		}
+		Map* map = new Map();
+		ApplySettings(*map, settings);
+		map->setThreads(1); // the seeded turn update, rand() would make sessions contend on its lock and depend on each other
+		map->setSeed(settings.seed + command.session);
+		map->shareFrom(*command.base);
+		shard.sessions[local] = { map, settings.seed + command.session + 1, 0 };
+		shard.open++;
+		return;
+	}
+	if (command.action == HOST_RUN) { // turn by turn across the shard's sessions, so they all advance at the same pace
+		for (int t = 0; t < command.turns; t++) {
+			for (int i = 0; i < shard.sessionsSize; i++) {
+				HostSession& session = shard.sessions[i];
+				if (!session.map) { continue; }
+				char key = "wasd."[NextRandom(session.random) % 5];
+				if (key == '.') { session.map->moveEnemies(); }
+				else { session.map->move(key); }
+				session.turns++;
+				shard.turns++;
+			}
+		}
+		return;
+	}
+	HostSession* session = find(shard, command.session);
+	if (!session) {
+		HostReply(*command.client, "error no session " + to_string(command.session));
+		return;
+	}
+	if (command.action == HOST_CLOSE) {
+		delete session->map;
+		session->map = nullptr;
+		shard.open--;
+		HostReply(*command.client, "closed " + to_string(command.session));
+		return;
+	}
+	for (size_t i = 0; i < command.keys.size(); i++) {
+		char key = (char)tolower(command.keys[i]);
+		if (key == '.') { session->map->moveEnemies(); }
+		else if (key == 'w' || key == 'a' || key == 's' || key == 'd') { session->map->move(key); }
+		else { continue; }
+		session->turns++;
+		shard.turns++;
+	}
+	HostReply(*command.client, "moved " + to_string(command.session) + " " + to_string(session->map->getUserVertex()) + " "
+		+ to_string(session->turns));
+}
+// protocol, one command per line and one reply line per command:
+//   open <map> [count]   starts count sessions on a map file        -> opened <first id> <count>
+//   move <id> <keys>     plays w, a, s, d or . (wait) in order       -> moved <id> <user tile> <turns played>
+//   run <turns>          every session takes that many random turns  -> ran <turns> <turns/sec>
+//   close <id>           ends a session                              -> closed <id>
+//   stats                waits for the shards to catch up            -> stats <sessions> <turns> <turns/sec>
+//   quit                 stops reading this client                   -> bye
+bool SessionHost::handle(string line, HostClient& client) {
+	istringstream in(line);
+	string command;
+	if (!(in >> command)) { return true; } // blank line
+	HostCommand posted;
+	posted.client = &client;
+	posted.turns = 0;
+	posted.base = nullptr;
+	if (command == "open") {
+		string filename;
+		int count = 1;
+		in >> filename >> count;
+		Map* base = filename.empty() ? nullptr : loadBase(filename);
+		if (!base || count < 1) {
+			HostReply(client, "error could not open " + filename);
+			return true;
+		}
+		int first = nextSession.fetch_add(count);
+		posted.action = HOST_OPEN;
+		posted.base = base;
+		for (int i = 0; i < count; i++) {
+			posted.session = first + i;
+			post(posted.session % numShards, posted);
+		}
+		HostReply(client, "opened " + to_string(first) + " " + to_string(count));
+	}
+	else if (command == "move" || command == "close") {
+		posted.action = (command == "move") ? HOST_MOVE : HOST_CLOSE;
+		posted.session = -1;
+		in >> posted.session >> posted.keys;
+		if (posted.session < 0) {
+			HostReply(client, "error no session given");
+			return true;
+		}
+		post(posted.session % numShards, posted);
+	}
+	else if (command == "run") {
+		in >> posted.turns;
+		long long before = getTurns();
+		auto runStart = chrono::steady_clock::now();
+		posted.action = HOST_RUN;
+		posted.session = -1;
+		for (int i = 0; i < numShards; i++) { post(i, posted); }
+		sync(client);
+		ostringstream reply;
+		reply << "ran " << posted.turns << " " << (getTurns() - before) / ElapsedSeconds(runStart);
+		HostReply(client, reply.str());
+	}
+	else if (command == "stats") {
+		sync(client);
+		ostringstream reply;
+		reply << "stats " << getSessions() << " " << getTurns() << " " << getTurns() / getSeconds();
+		HostReply(client, reply.str());
+	}
+	else if (command == "quit") {
+		sync(client);
+		HostReply(client, "bye");
+		return false;
+	}
+	else { HostReply(client, "error unknown command " + command); }
+	return true;
+}
+
+void SessionHost::sync(HostClient& client) {
+	while (client.pending > 0) { this_thread::sleep_for(chrono::microseconds(50)); }
+}
+
+long long SessionHost::getTurns() {
+	long long total = 0;
+	for (int i = 0; i < numShards; i++) { total += shards[i].turns; }
+	return total;
+}
+
+int SessionHost::getSessions() {
+	int total = 0;
+	for (int i = 0; i < numShards; i++) { total += shards[i].open; }
+	return total;
+}
+
+double SessionHost::getSeconds() { return ElapsedSeconds(start); }
+
+bool ReadLine(int fd, string& buffered, string& line) { // next line from a socket, false once it is closed
+#ifndef _WIN32
+	while (true) {
+		size_t newline = buffered.find('\n');
+		if (newline != string::npos) {
+			line = buffered.substr(0, newline);
+			buffered.erase(0, newline + 1);
+			return true;
+		}
+		char chunk[4096];
+		ssize_t n = read(fd, chunk, sizeof(chunk));
+		if (n <= 0) {
+			line = buffered;
+			buffered.clear();
+			return !line.empty();
+		}
+		buffered.append(chunk, n);
+	}
+#else
+	return false;
+#endif
+}
+// serves every client connecting to a Unix socket on its own thread until one of them sends quit
+int ServeSocket(SessionHost& host, string path) {
+#ifdef _WIN32
+	cout << "--socket is only supported on POSIX systems, pipe the commands into stdin instead\n";
+	return 1;
+#else
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		cout << "Socket path too long: " << path << "\n";
+		return 1;
+	}
+	strcpy(address.sun_path, path.c_str());
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path.c_str());
+	if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+		cout << "Could not listen on " << path << "\n";
+		if (listener >= 0) { close(listener); }
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN); // a client that disconnects early must not take the host down
+	cout << "listening on " << path << "\n" << flush;
+	mutex connectionsLock; // taken when clients connect, disconnect or the host stops
+	thread* connections = nullptr;
+	int* fds = nullptr; // -1 once the connection is done
+	int numConnections = 0, connectionsSize = 0;
+	atomic<bool> stopping(false);
+	while (!stopping) {
+		int fd = accept(listener, nullptr, nullptr);
+		if (fd < 0) { break; } // the listener is shut down when a client sends quit
+		lock_guard<mutex> guard(connectionsLock);
+		if (numConnections == connectionsSize) {
+			connectionsSize = (connectionsSize == 0) ? 8 : connectionsSize * 2;
+			thread* temp = new thread[connectionsSize];
+			int* tempFds = new int[connectionsSize];
+			for (int i = 0; i < numConnections; i++) {
+				temp[i] = move(connections[i]);
+				tempFds[i] = fds[i];
+			}
+			delete[] connections;
+			delete[] fds;
+			connections = temp;
+			fds = tempFds;
+		}
+		int slot = numConnections++;
+		fds[slot] = fd;
+		connections[slot] = thread([&host, &stopping, &connectionsLock, &fds, listener, slot, fd] {
+			HostClient client(fd);
+			string buffered, line;
+			while (ReadLine(fd, buffered, line)) {
+				if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+				if (!host.handle(line, client)) {
+					stopping = true;
+					shutdown(listener, SHUT_RDWR);
+					break;
+				}
+			}
+			host.sync(client); // shards may still be answering
+			lock_guard<mutex> closing(connectionsLock);
+			close(fd);
+			fds[slot] = -1;
+		});
+	}
+	{
+		lock_guard<mutex> guard(connectionsLock);
+		for (int i = 0; i < numConnections; i++) {
+			if (fds[i] >= 0) { shutdown(fds[i], SHUT_RDWR); } // wakes the clients still connected
+		}
+	}
+	for (int i = 0; i < numConnections; i++) { connections[i].join(); }
+	delete[] connections;
+	delete[] fds;
+	close(listener);
+	unlink(path.c_str());
+	return 0;
+#endif
+}
+// runs game sessions for clients on stdin or a Unix socket, and reports the aggregate throughput once they are done
+int RunHost(Settings& settings) {
+	int shards = settings.threads;
+	if (shards < 1) { shards = (int)thread::hardware_concurrency(); }
+	int result = 0;
+	long long turns;
+	int sessions;
+	double seconds;
+	{
+		SessionHost host(shards, settings);
+		if (settings.socket.empty()) {
+			HostClient client(-1);
+			string line;
+			while (getline(cin, line)) {
+				if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+				if (!host.handle(line, client)) { break; }
+			}
+			host.sync(client);
+		}
+		else { result = ServeSocket(host, settings.socket); }
+		shards = host.size();
+		turns = host.getTurns();
+		sessions = host.getSessions();
+		seconds = host.getSeconds();
+	}
+	cerr << "host: " << shards << " shards, " << sessions << " sessions open, " << turns << " turns in " << seconds << " s, "
+		<< turns / seconds << " turns/sec\n";
+	return result;
+}
+
+void PrintUsage() {
+	cout << "Usage:\n";
+	cout << "  (no arguments)                                play the game\n";
+	cout << "  --simulate <map> [options]                    run turns headless and report turns/sec and latency\n";
+	cout << "  --bench <map> [options]                       time mapFromFile, mapToGraph, enemy lookups, reachability and path queries\n";
+	cout << "  --generate <maze|open|grass|hidden|world> <width> <height> <file> [options]  world writes a chunked world for --world\n";
+	cout << "  --compile <map> [file] [--graph csr] [--landmarks <n>]  write a compiled map, loaded instead of the text map from then on\n";
+	cout << "  --host [--socket <path>] [options]            run game sessions for commands on stdin or a Unix socket, --threads shards\n";
+	cout << "  --world <file> [--chunks <n>] [options]       walk a chunked world, reading chunks on demand into n slots\n";
+	cout << "  --crossover [map...] [options]                time Dijkstra with each queue on growing maps to find where dense stops winning\n";
+	cout << "Options:\n";
+	cout << "  --mode <dijkstra|flow|astar|hpa|incremental|alt|ch>  --queue <heap|bucket|dense|auto>  --graph <grid|csr>\n";
+	cout << "  --threads <n>  --turns <n>  --queries <n>  --cluster <n>  --landmarks <n>  --enemies <n>  --seed <n>  --script <file>\n";
+	cout << "  --path-cache <n>  cache the next steps of n (enemy tile, user tile) pairs for dijkstra, astar and alt\n";
+	cout << "  --stats <file.json|file.csv>  record search and turn instrumentation and write it out at the end\n";
 }
-// clear screen function for use during game (to prevent flickering)
-void ClearScreen() {
-	COORD cursorPosition;
-	cursorPosition.X = 0;
-	cursorPosition.Y = 0;
-	SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), cursorPosition);
+// headless tools used to measure performance, the game itself runs when there are no arguments
+int RunCommand(int argc, char* argv[]) {
+	Settings settings;
+	settings.mode = CHASE_DIJKSTRA;
+	settings.queue = AUTO_QUEUE;
+	settings.graph = IMPLICIT_GRID;
+	settings.threads = 0;
+	settings.turns = 1000;
+	settings.queries = 200;
+	settings.clusterSize = 10;
+	settings.landmarks = 0;
+	settings.enemies = 5;
+	settings.pathCache = 0;
+	settings.chunks = DEFAULT_CHUNK_SLOTS;
+	settings.seed = 1;
+	string command = argv[1];
+	string positional[4];
+	int numPositional = 0;
+	for (int i = 2; i < argc; i++) {
+		string option = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (option.size() > 2 && option[0] == '-' && option[1] == '-' && !hasValue) {
+			PrintUsage();
+			return 1;
+		}
+		if (option == "--mode") {
+			string value = argv[++i];
+			if (value == "flow") { settings.mode = CHASE_FLOW_FIELD; }
+			else if (value == "astar") { settings.mode = CHASE_ASTAR; }
+			else if (value == "hpa") { settings.mode = CHASE_HIERARCHICAL; }
+			else if (value == "incremental") { settings.mode = CHASE_INCREMENTAL; }
+			else if (value == "alt") { settings.mode = CHASE_LANDMARKS; }
+			else if (value == "ch") { settings.mode = CHASE_CONTRACTION; }
+			else { settings.mode = CHASE_DIJKSTRA; }
+		}
+		else if (option == "--queue") {
+			string value = argv[++i];
+			if (value == "heap") { settings.queue = BINARY_HEAP; }
+			else if (value == "bucket") { settings.queue = BUCKET_QUEUE; }
+			else if (value == "dense") { settings.queue = DENSE_ARRAY; }
+			else { settings.queue = AUTO_QUEUE; }
+		}
+		else if (option == "--graph") { settings.graph = (strcmp(argv[++i], "csr") == 0) ? CSR_GRAPH : IMPLICIT_GRID; }
+		else if (option == "--threads") { settings.threads = atoi(argv[++i]); }
+		else if (option == "--turns") { settings.turns = atoi(argv[++i]); }
+		else if (option == "--queries") { settings.queries = atoi(argv[++i]); }
+		else if (option == "--cluster") { settings.clusterSize = atoi(argv[++i]); }
+		else if (option == "--landmarks") { settings.landmarks = atoi(argv[++i]); }
+		else if (option == "--enemies") { settings.enemies = atoi(argv[++i]); }
+		else if (option == "--path-cache") { settings.pathCache = atoi(argv[++i]); }
+		else if (option == "--chunks") { settings.chunks = atoi(argv[++i]); }
+		else if (option == "--seed") { settings.seed = (unsigned int)atoi(argv[++i]); }
+		else if (option == "--script") { settings.script = argv[++i]; }
+		else if (option == "--stats") { settings.stats = argv[++i]; }
+		else if (option == "--socket") { settings.socket = argv[++i]; }
+		else if (numPositional < 4) { positional[numPositional++] = option; }
+	}
+	if (settings.turns < 1) { settings.turns = 1; }
+	if (settings.queries < 1) { settings.queries = 1; }
+	if (command == "--simulate" && numPositional >= 1) { return RunSimulation(positional[0], settings); }
+	if (command == "--bench" && numPositional >= 1) { return RunBenchmarks(positional[0], settings); }
+	if (command == "--compile" && numPositional >= 1) { return CompileMap(positional[0], positional[1], settings); }
+	if (command == "--host") { return RunHost(settings); }
+	if (command == "--crossover") { return RunCrossover(positional, numPositional, settings); }
+	if (command == "--world" && numPositional >= 1) { return RunWorld(positional[0], settings); }
+	if (command == "--generate" && numPositional >= 4 && positional[0] == "world") {
+		if (!GenerateWorld(atoi(positional[1].c_str()), atoi(positional[2].c_str()), settings.seed, positional[3])) {
+			cout << "Could not generate " << positional[3] << "\n";
+			return 1;
+		}
+		return 0;
+	}
+	if (command == "--generate" && numPositional >= 4) {
+		if (!GenerateMap(positional[0], atoi(positional[1].c_str()), atoi(positional[2].c_str()), settings.enemies, settings.seed, positional[3])) {
+			cout << "Could not generate " << positional[3] << "\n";
+			return 1;
+		}
+		return 0;
+	}
+	PrintUsage();
+	return 1;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+	if (argc > 1) { return RunCommand(argc, argv); }
 	srand(time(0));
 
 	char input;
@@ -621,6 +5488,10 @@ int main() {
 	testMap.mapToGraph();
 
 	Map map(784);
+	map.setPathCache(DEFAULT_PATH_CACHE); // standing still or skipping turns asks the same questions again
+	FrameRenderer renderer;
+	Instrumentation stats; // only attached once P asks for it, recording slows every turn down
+	bool recording = false;
 	int mapNumber = rand() % 5;
 	int currentMap = mapNumber;
 	if (mapNumber == 0) { map.mapFromFile("map2.txt"); }
@@ -636,26 +5507,32 @@ int main() {
 	while (!endGame) {
 		switch (input) {
 		case 'w': // starts/continues game
-			system("cls");
-			map.printMap();
+			ClearConsole();
+			renderer.fitTerminal();
+			renderer.draw(map);
 			input = '-';
 			while (tolower(input) != 'q') { // loops while user does not press 'q'
 				input = _getch();
-				if (input == ' ') {
-					map.moveEnemies();
-					ClearScreen(); // use system("cls") instead if not on Windows OS
-					map.printMap();
-				}
-				else {
-					map.move(input);
-					ClearScreen(); // use system("cls") instead if not on Windows OS
-					map.printMap();
+				if (tolower(input) == 'p') { // starts recording, then dumps the instrumentation, without taking a turn
+					if (!recording) {
+						map.setInstrumentation(&stats);
+						recording = true;
+						cout << "Recording timings, press P again to write them to stats.json";
+					}
+					else { cout << (stats.dump("stats.json") ? "Instrumentation written to stats.json" : "Could not write stats.json"); }
+					continue;
 				}
+				PROBE(if (recording) { stats.beginTurn(); })
+				if (input == ' ') { map.moveEnemies(); }
+				else { map.move(input); }
+				PROBE(long long renderStart = recording ? NowNanos() : 0;)
+				renderer.draw(map); // only the tiles that changed are written
+				PROBE(if (recording) { stats.turnRendering += NowNanos() - renderStart; stats.endTurn(); })
 			}
 			input = ' ';
 			break;
 		case 'a': // show example map and adjacency list
-			system("cls");
+			ClearConsole();
 			cout << "\n\tExample map:\n\n";
 			testMap.printMap();
 			cout << "\nPress any key to print adjacency list...\n";
@@ -664,19 +5541,20 @@ int main() {
 			testMap.printList();
 			cout << "\n\nPress any key to return to main menu...";
 			input = _getch();
-			system("cls");
+			ClearConsole();
 			PrintMenu();
 			input = ' ';
 			break;
 		case 's': // prints controls and instructions
-			system("cls");
+			ClearConsole();
 			cout << "\n| Controls and Info:\n\n";
 			cout << "| The object of the game is to not be caught by an enemy. The enemies will move around the map randomly until you are\n";
 			cout << "| in sight. They will then move towards you until they reach you or you get to a hidden tile. If they reach you, you\n";
 			cout << "| will respawn at a random hidden tile within the map.\n\n";
 			cout << "| Move with W, A, S, and D (up, left, down, and right respectively)\n";
 			cout << "| Press Space if you would like to skip a turn (the enemies will still move)\n";
-			cout << "| Press Q at any point during the game to quit\n\n";
+			cout << "| Press Q at any point during the game to quit\n";
+			cout << "| Press P to start recording search and turn timings, and again to write them to stats.json\n\n";
 			cout << "| Map tiles:\n";
 			cout << "| Blank tiles are plain ground and require 1 move to move across\n";
 			cout << "|";
@@ -706,7 +5584,7 @@ int main() {
 			cout << " is your character\n\n";
 			cout << "Press any key to return to the main menu...";
 			input = _getch();
-			system("cls");
+			ClearConsole();
 			PrintMenu();
 			input = ' ';
 			break;
@@ -726,7 +5604,7 @@ int main() {
 			endGame = true;
 			break;
 		default: // invalid inputs do not do anything, prompts user to input again
-			system("cls");
+			ClearConsole();
 			PrintMenu();
 			input = GetInput();
 		}